@@ -0,0 +1,219 @@
+/*
+ * Microbenchmark for header parsers and urljoin.
+ *
+ * Build from the top directory, e.g.:
+ *
+ *   cc -O2 -std=c2x -I. bench/http_parsers_bench.c uw_http*.c -luw -lcurl -lz -lpthread -o http_parsers_bench
+ *
+ * Usage: http_parsers_bench [iterations]
+ *
+ * Reports nanoseconds and heap allocations per operation.
+ * Allocations are counted by wrapping malloc family, glibc only.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Allocation counter
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void  __libc_free(void* ptr);
+
+static uint64_t num_allocs = 0;
+
+void* malloc(size_t size)
+{
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    num_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+/****************************************************************
+ * Corpus
+ */
+
+static char* content_types[] = {
+    "text/html",
+    "text/html; charset=utf-8",
+    "text/html;charset=UTF-8",
+    "text/plain; charset=\"iso-8859-1\"",
+    "application/json; charset=utf-8",
+    "application/octet-stream",
+    "application/x-www-form-urlencoded",
+    "image/svg+xml",
+    "multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW",
+    "multipart/mixed; boundary=\"simple \\\"boundary\\\"\"",
+    "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet",
+    "text/csv; charset=windows-1251; header=present",
+};
+
+static char* content_dispositions[] = {
+    "inline",
+    "attachment",
+    "attachment; filename=\"report.pdf\"",
+    "attachment; filename=genome.jpeg; modification-date=\"Wed, 12 Feb 1997 16:29:51 -0500\"",
+    "attachment; filename*=UTF-8''%e2%82%ac%20rates.txt",
+    "attachment; filename=\"EURO rates\"; filename*=utf-8''%e2%82%ac%20rates",
+    "attachment; filename*=iso-8859-1'en'%A3%20rates",
+    "attachment; filename*=UTF-8''%D0%9E%D1%82%D1%87%D0%B5%D1%82%202024.xlsx",
+    "form-data; name=\"field\\\"name\"; filename=\"C:\\\\temp\\\\file.txt\"",
+    "attachment; filename=\"\"",
+};
+
+static char* urls[][2] = {
+    { "https://example.com/a/b/c.html", "../d.html" },
+    { "https://example.com/a/b/c.html", "/root.html" },
+    { "https://example.com/a/b/", "https://other.example.org/x?y=1#z" },
+    { "http://example.com:8080/path/index.php?q=1", "?q=2" },
+    { "https://example.com/very/long/path/to/some/deeply/nested/page.html", "../../../../x/y/z.css" },
+};
+
+#define NUM_ITEMS(array)  (sizeof(array) / sizeof((array)[0]))
+
+/****************************************************************
+ * Benchmarks
+ */
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void report(char* name, uint64_t ops, uint64_t elapsed_ns, uint64_t allocs)
+{
+    printf("%-28s %10.1f ns/op %8.2f allocs/op\n",
+           name, (double) elapsed_ns / ops, (double) allocs / ops);
+}
+
+static void bench_media_type(unsigned iterations)
+{
+    HttpArena arena = {};
+    HttpHeaderView view;
+
+    // warm up arena
+    http_parse_media_type(content_types[0], &arena, &view);
+
+    uint64_t allocs = num_allocs;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < iterations; i++) {
+        for (unsigned j = 0; j < NUM_ITEMS(content_types); j++) {
+            http_parse_media_type(content_types[j], &arena, &view);
+        }
+        http_arena_reset(&arena);
+    }
+    report("parse_media_type", (uint64_t) iterations * NUM_ITEMS(content_types),
+           now_ns() - start, num_allocs - allocs);
+    http_arena_free(&arena);
+}
+
+static void bench_content_disposition(unsigned iterations)
+{
+    HttpArena arena = {};
+    HttpHeaderView view;
+
+    http_parse_content_disposition(content_dispositions[0], &arena, &view);
+
+    uint64_t allocs = num_allocs;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < iterations; i++) {
+        for (unsigned j = 0; j < NUM_ITEMS(content_dispositions); j++) {
+            http_parse_content_disposition(content_dispositions[j], &arena, &view);
+        }
+        http_arena_reset(&arena);
+    }
+    report("parse_content_disposition", (uint64_t) iterations * NUM_ITEMS(content_dispositions),
+           now_ns() - start, num_allocs - allocs);
+    http_arena_free(&arena);
+}
+
+static void bench_ext_value(unsigned iterations)
+/*
+ * Only dispositions with ext-value.
+ */
+{
+    HttpArena arena = {};
+    HttpHeaderView view;
+    char* items[NUM_ITEMS(content_dispositions)];
+    unsigned num_items = 0;
+
+    for (unsigned j = 0; j < NUM_ITEMS(content_dispositions); j++) {
+        if (strchr(content_dispositions[j], '*')) {
+            items[num_items++] = content_dispositions[j];
+        }
+    }
+    http_parse_content_disposition(items[0], &arena, &view);
+
+    uint64_t allocs = num_allocs;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < iterations; i++) {
+        for (unsigned j = 0; j < num_items; j++) {
+            http_parse_content_disposition(items[j], &arena, &view);
+        }
+        http_arena_reset(&arena);
+    }
+    report("parse_ext_value", (uint64_t) iterations * num_items, now_ns() - start, num_allocs - allocs);
+    http_arena_free(&arena);
+}
+
+static void bench_urljoin(unsigned iterations)
+{
+    uint64_t allocs = num_allocs;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < iterations; i++) {
+        for (unsigned j = 0; j < NUM_ITEMS(urls); j++) {
+            UwValue result = urljoin_cstr(urls[j][0], urls[j][1]);
+        }
+    }
+    report("urljoin_cstr", (uint64_t) iterations * NUM_ITEMS(urls), now_ns() - start, num_allocs - allocs);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned iterations = 100000;
+    if (argc > 1) {
+        iterations = (unsigned) strtoul(argv[1], nullptr, 10);
+        if (iterations == 0) {
+            iterations = 1;
+        }
+    }
+    init_http();
+
+    bench_media_type(iterations);
+    bench_content_disposition(iterations);
+    bench_ext_value(iterations);
+    bench_urljoin(iterations / 10 + 1);
+
+    cleanup_http();
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * libFuzzer harness for header parsers and urljoin.
+ *
+ * Build from the top directory with clang, e.g.:
+ *
+ *   clang -g -O1 -std=c2x -fsanitize=fuzzer,address,undefined -I. bench/http_parsers_fuzz.c uw_http*.c \
+ *         -luw -lcurl -lz -lpthread -o http_parsers_fuzz
+ *
+ * Usage: http_parsers_fuzz [corpus directory] [libFuzzer options]
+ *
+ * Input is copied to a buffer of exact size, so reading past the terminator is reported.
+ * The whole input is parsed as Content-Type and Content-Disposition,
+ * then the part before the first newline and the rest are passed to urljoin_cstr
+ * as base and relative URL.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+static volatile unsigned sink;
+
+static void touch(HttpSlice* slice)
+/*
+ * Read every byte of the slice, so that sanitizer checks its bounds.
+ */
+{
+    for (size_t i = 0; i < slice->length; i++) {
+        sink += (uint8_t) slice->ptr[i];
+    }
+}
+
+static void touch_view(HttpHeaderView* view)
+{
+    touch(&view->type);
+    touch(&view->subtype);
+    for (unsigned i = 0; i < view->num_params; i++) {
+        HttpHeaderParam* param = &view->params[i];
+        touch(&param->name);
+        touch(&param->value);
+        if (param->is_ext_value) {
+            // e.g. filename*=UTF-8'en'%e2%82%ac
+            touch(&param->charset);
+            touch(&param->language);
+        }
+    }
+}
+
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    init_http();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* header = malloc(size + 1);
+    if (!header) {
+        return 0;
+    }
+    memcpy(header, data, size);
+    header[size] = 0;
+
+    HttpArena arena = {};
+    HttpHeaderView view;
+
+    if (http_parse_media_type(header, &arena, &view)) {
+        touch_view(&view);
+    }
+    http_arena_reset(&arena);
+
+    if (http_parse_content_disposition(header, &arena, &view)) {
+        touch_view(&view);
+        HttpHeaderParam* filename = http_header_view_param(&view, "filename");
+        if (filename) {
+            touch(&filename->value);
+        }
+    }
+    http_arena_free(&arena);
+
+    // exact size copies as well
+    char* newline = memchr(header, '\n', size);
+    if (newline) {
+        size_t base_length = newline - header;
+        char* base_url = strndup(header, base_length);
+        char* other_url = strndup(newline + 1, size - base_length - 1);
+        if (base_url && other_url) {
+            UwValue result = urljoin_cstr(base_url, other_url);
+        }
+        free(base_url);
+        free(other_url);
+    }
+    free(header);
+    return 0;
+}
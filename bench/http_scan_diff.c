@@ -0,0 +1,264 @@
+/*
+ * Differential test of vector scanners against byte-at-a-time ones
+ * the header parsers used before.
+ *
+ * Build from the top directory, e.g.:
+ *
+ *   cc -O2 -std=c2x -I. bench/http_scan_diff.c -o http_scan_diff
+ *
+ * Usage: http_scan_diff [iterations]
+ *
+ * The scanner source is included to reach every kernel the CPU supports,
+ * not only the dispatched one. Strings are placed at every alignment
+ * and with the terminator at the very end of a page followed by an unmapped one.
+ * Exits with non-zero status on the first mismatch.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "uw_http_scan.c"
+
+/****************************************************************
+ * Reference scanners, as in parse_token and parse_quoted_string before
+ */
+
+static bool ref_is_ctl(unsigned char c)
+{
+    return (0 <= c && c <= 31) || c == 127;
+}
+
+static bool ref_is_separator(unsigned char c)
+{
+    switch (c) {
+        case '(':  case ')':  case '<':  case '>':  case '@':
+        case ',':  case ';':  case ':':  case '\\': case '"':
+        case '/':  case '[':  case ']':  case '?':  case '=':
+        case '{':  case '}':  case ' ':  case '\t':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ref_is_mime_charsetc(unsigned char c)
+{
+    if (isalnum(c)) {
+        return true;
+    }
+    switch (c) {
+        case '!':  case '#':  case '$':  case '%':  case '&':
+        case '+':  case '-':  case '^':  case '_':  case '`':
+        case '{':  case '}':  case '~':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ref_is_attr_char(unsigned char c)
+{
+    if (isalnum(c)) {
+        return true;
+    }
+    switch (c) {
+        case '!':  case '#':  case '$':  case '&':  case '+':  case '-':  case '.':
+        case '^':  case '_':  case '`':  case '|':  case '~':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ref_is_lwsp(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static char* ref_scan_token(char* ptr)
+{
+    while (!(ref_is_separator(*ptr) || ref_is_ctl(*ptr))) {
+        ptr++;
+    }
+    return ptr;
+}
+
+static char* ref_scan_qdtext(char* ptr)
+{
+    for (;;) {
+        unsigned char c = *ptr;
+        if (c == '"' || c == '\\' || (ref_is_ctl(c) && c != '\t')) {
+            return ptr;
+        }
+        ptr++;
+    }
+}
+
+static size_t ref_ascii_prefix(uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    while (i < size && data[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/****************************************************************
+ * Kernels under test
+ */
+
+typedef struct {
+    char* name;
+    ScanFunc scan;
+    AsciiPrefixFunc ascii_prefix;
+} Kernel;
+
+static Kernel kernels[4];
+static unsigned num_kernels = 0;
+
+static void init_kernels()
+{
+    kernels[num_kernels++] = (Kernel) { "scalar", scan_scalar, ascii_prefix_scalar };
+#   ifdef HTTP_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("ssse3")) {
+            kernels[num_kernels++] = (Kernel) { "ssse3/sse2", scan_ssse3, ascii_prefix_sse2 };
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            kernels[num_kernels++] = (Kernel) { "avx2", scan_avx2, ascii_prefix_avx2 };
+        }
+#   endif
+    // dispatched functions, as called by the parsers
+    kernels[num_kernels++] = (Kernel) { "dispatched", nullptr, nullptr };
+}
+
+/****************************************************************
+ * Checks
+ */
+
+#define MAX_LENGTH  300
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng()
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned random_string(uint8_t* str)
+/*
+ * Mostly runs of token characters with rare stop ones, so that scans go past a few blocks.
+ * Return length, the string is null-terminated.
+ */
+{
+    static char token_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!#$%&'*+-.^_`|~";
+    unsigned length = rng() % MAX_LENGTH;
+    unsigned stop_rate = 1 + rng() % 64;
+    for (unsigned i = 0; i < length; i++) {
+        uint64_t r = rng();
+        if (r % stop_rate == 0) {
+            // any byte, including separators, CTLs, quotes and 0x80-0xFF
+            str[i] = (uint8_t) (r >> 32);
+            if (str[i] == 0) {
+                str[i] = 0xFF;
+            }
+        } else {
+            str[i] = token_chars[(r >> 32) % (sizeof(token_chars) - 1)];
+        }
+    }
+    str[length] = 0;
+    return length;
+}
+
+static bool check_at(Kernel* kernel, char* str, unsigned length)
+{
+    char* token  = kernel->scan? kernel->scan(str, &token_stop_set)  : http_scan_token(str);
+    char* qdtext = kernel->scan? kernel->scan(str, &qdtext_stop_set) : http_scan_qdtext(str);
+    size_t ascii = kernel->ascii_prefix? kernel->ascii_prefix((uint8_t*) str, length)
+                                       : http_ascii_prefix((uint8_t*) str, length);
+
+    char* ref_token  = ref_scan_token(str);
+    char* ref_qdtext = ref_scan_qdtext(str);
+    size_t ref_ascii = ref_ascii_prefix((uint8_t*) str, length);
+
+    if (token == ref_token && qdtext == ref_qdtext && ascii == ref_ascii) {
+        return true;
+    }
+    fprintf(stderr, "MISMATCH %s, length %u, address %p: token %td/%td qdtext %td/%td ascii %zu/%zu\n",
+            kernel->name, length, (void*) str,
+            token - str, ref_token - str, qdtext - str, ref_qdtext - str, ascii, ref_ascii);
+    for (unsigned i = 0; i <= length; i++) {
+        fprintf(stderr, "%02x", (uint8_t) str[i]);
+    }
+    fputc('\n', stderr);
+    return false;
+}
+
+static bool check_classes()
+{
+    for (unsigned c = 0; c < 256; c++) {
+        uint8_t cls = http_char_class[c];
+        bool ok = ((cls & HTTP_CHAR_CTL) != 0) == ref_is_ctl(c)
+                  && ((cls & HTTP_CHAR_TOKEN) != 0) == !(ref_is_separator(c) || ref_is_ctl(c))
+                  && ((cls & HTTP_CHAR_QDTEXT) != 0) == !(c == '"' || c == '\\' || (ref_is_ctl(c) && c != '\t'))
+                  && ((cls & HTTP_CHAR_MIME_CHARSETC) != 0) == ref_is_mime_charsetc(c)
+                  && ((cls & HTTP_CHAR_ATTR_CHAR) != 0) == ref_is_attr_char(c)
+                  && ((cls & HTTP_CHAR_LWSP) != 0) == ref_is_lwsp(c);
+        if (!ok) {
+            fprintf(stderr, "MISMATCH character class of 0x%02x\n", c);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned iterations = (argc > 1)? (unsigned) atoi(argv[1]) : 20000;
+
+    if (!check_classes()) {
+        return 1;
+    }
+    init_kernels();
+
+    // two pages for strings ending at page boundary, the second one is made inaccessible
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint8_t* pages = mmap(nullptr, page_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED || mprotect(pages + page_size, page_size, PROT_NONE) == -1) {
+        perror("mmap");
+        return 2;
+    }
+    static _Alignas(64) uint8_t buffer[MAX_LENGTH + 128];
+    uint8_t str[MAX_LENGTH + 1];
+
+    uint64_t checks = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        unsigned length = random_string(str);
+        for (unsigned k = 0; k < num_kernels; k++) {
+            for (unsigned align = 0; align < 64; align++) {
+                memcpy(buffer + align, str, length + 1);
+                if (!check_at(&kernels[k], (char*) buffer + align, length)) {
+                    return 1;
+                }
+                checks++;
+            }
+            char* tail = (char*) pages + page_size - (length + 1);
+            memcpy(tail, str, length + 1);
+            if (!check_at(&kernels[k], tail, length)) {
+                return 1;
+            }
+            checks++;
+        }
+    }
+    printf("%lu checks of %u kernels passed\n", (unsigned long) checks, num_kernels);
+    return 0;
+}
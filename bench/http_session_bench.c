@@ -0,0 +1,937 @@
+/*
+ * End-to-end session throughput benchmark against a loopback server.
+ *
+ * Build from the top directory, e.g.:
+ *
+ *   cc -O2 -std=c2x -I. bench/http_session_bench.c uw_http*.c -luw -lcurl -lz -lpthread -o http_session_bench
+ *
+ * Add -DHTTP_WITH_BROTLI -lbrotlidec and -DHTTP_WITH_ZSTD -lzstd for optional content codecs.
+ *
+ * Usage: http_session_bench [options]
+ *
+ *   -n NUM     total requests, default 10000
+ *   -c NUM     concurrent requests, default 1000
+ *   -s BYTES   response body size, default 1024
+ *   -l MS      server latency, milliseconds, default 0
+ *   -k         chunked transfer encoding, HTTP/1.1 only
+ *   -z         gzip-encoded body
+ *   -2         HTTP/2 over cleartext, prior knowledge
+ *   -e         epoll engine
+ *   -t NUM     server threads, default 2
+ *
+ * The server runs in a child process, so that resource usage
+ * reported for the client is not polluted by the server.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+typedef struct {
+    unsigned num_requests;
+    unsigned concurrency;
+    size_t   body_size;
+    unsigned latency;       // milliseconds
+    bool     chunked;
+    bool     gzip;
+    bool     http2;
+    bool     epoll;
+    unsigned num_threads;
+} BenchConfig;
+
+static BenchConfig config = {
+    .num_requests = 10000,
+    .concurrency  = 1000,
+    .body_size    = 1024,
+    .num_threads  = 2
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/****************************************************************
+ * Byte buffer
+ */
+
+typedef struct {
+    uint8_t* data;
+    size_t   start;  // consumed bytes
+    size_t   size;
+    size_t   capacity;
+} Buffer;
+
+static void buffer_reserve(Buffer* buf, size_t size)
+{
+    if (buf->start && buf->start == buf->size) {
+        buf->start = 0;
+        buf->size = 0;
+    }
+    if (buf->size + size <= buf->capacity) {
+        return;
+    }
+    if (buf->start) {
+        memmove(buf->data, buf->data + buf->start, buf->size - buf->start);
+        buf->size -= buf->start;
+        buf->start = 0;
+        if (buf->size + size <= buf->capacity) {
+            return;
+        }
+    }
+    size_t capacity = buf->capacity? buf->capacity : 4096;
+    while (capacity < buf->size + size) {
+        capacity *= 2;
+    }
+    buf->data = realloc(buf->data, capacity);
+    if (!buf->data) {
+        perror("realloc");
+        exit(1);
+    }
+    buf->capacity = capacity;
+}
+
+static void buffer_append(Buffer* buf, void* data, size_t size)
+{
+    buffer_reserve(buf, size);
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static inline size_t buffer_length(Buffer* buf)
+{
+    return buf->size - buf->start;
+}
+
+/****************************************************************
+ * Response templates
+ */
+
+static uint8_t* body;       // possibly gzipped
+static size_t   body_size;
+static Buffer   http1_response;
+
+static void make_body()
+{
+    uint8_t* plain = malloc(config.body_size + 1);
+    // compressible text, like HTML
+    static char text[] = "<p>The quick brown fox jumps over the lazy dog.</p>\n";
+    for (size_t i = 0; i < config.body_size; i++) {
+        plain[i] = text[i % (sizeof(text) - 1)];
+    }
+    if (!config.gzip) {
+        body = plain;
+        body_size = config.body_size;
+        return;
+    }
+    z_stream zs = {};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "deflateInit2 failed\n");
+        exit(1);
+    }
+    size_t bound = deflateBound(&zs, config.body_size);
+    body = malloc(bound);
+    zs.next_in   = plain;
+    zs.avail_in  = config.body_size;
+    zs.next_out  = body;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "deflate failed\n");
+        exit(1);
+    }
+    body_size = zs.total_out;
+    deflateEnd(&zs);
+    free(plain);
+}
+
+static void make_http1_response()
+{
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/html; charset=utf-8\r\n"
+                     "%s"
+                     "%s",
+                     config.gzip? "Content-Encoding: gzip\r\n" : "",
+                     config.chunked? "Transfer-Encoding: chunked\r\n" : "");
+    buffer_append(&http1_response, header, n);
+    if (config.chunked) {
+        buffer_append(&http1_response, "\r\n", 2);
+        for (size_t offset = 0; offset < body_size; offset += 16384) {
+            size_t chunk_size = body_size - offset;
+            if (chunk_size > 16384) {
+                chunk_size = 16384;
+            }
+            n = snprintf(header, sizeof(header), "%zx\r\n", chunk_size);
+            buffer_append(&http1_response, header, n);
+            buffer_append(&http1_response, body + offset, chunk_size);
+            buffer_append(&http1_response, "\r\n", 2);
+        }
+        buffer_append(&http1_response, "0\r\n\r\n", 5);
+    } else {
+        n = snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", body_size);
+        buffer_append(&http1_response, header, n);
+        buffer_append(&http1_response, body, body_size);
+    }
+}
+
+/****************************************************************
+ * HTTP/2 framing, just enough for CURL client
+ */
+
+#define H2_DATA           0
+#define H2_HEADERS        1
+#define H2_PRIORITY       2
+#define H2_RST_STREAM     3
+#define H2_SETTINGS       4
+#define H2_PING           6
+#define H2_GOAWAY         7
+#define H2_WINDOW_UPDATE  8
+#define H2_CONTINUATION   9
+
+#define H2_FLAG_END_STREAM   0x1
+#define H2_FLAG_ACK          0x1
+#define H2_FLAG_END_HEADERS  0x4
+#define H2_FLAG_PADDED       0x8
+#define H2_FLAG_PRIORITY     0x20
+
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE  4
+#define H2_DEFAULT_WINDOW     65535
+#define H2_MAX_FRAME_SIZE     16384
+#define H2_MAX_STREAMS        1000
+
+static char h2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static Buffer h2_headers;  // HPACK block of response headers
+
+static void hpack_literal(Buffer* buf, unsigned static_index, char* value)
+/*
+ * Literal header field without indexing, indexed name.
+ */
+{
+    uint8_t b[2] = { 0x0F, (uint8_t) (static_index - 15) };  // all our indices are >= 15 and < 143
+    buffer_append(buf, b, 2);
+    uint8_t len = (uint8_t) strlen(value);  // short values only, no Huffman
+    buffer_append(buf, &len, 1);
+    buffer_append(buf, value, len);
+}
+
+static void make_h2_headers()
+{
+    uint8_t status_200 = 0x88;
+    buffer_append(&h2_headers, &status_200, 1);
+    hpack_literal(&h2_headers, 31, "text/html; charset=utf-8");  // content-type
+    if (config.gzip) {
+        hpack_literal(&h2_headers, 26, "gzip");  // content-encoding
+    }
+    if (!config.chunked) {
+        char len[32];
+        snprintf(len, sizeof(len), "%zu", body_size);
+        hpack_literal(&h2_headers, 28, len);  // content-length
+    }
+}
+
+static void h2_frame_header(Buffer* buf, size_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    uint8_t h[9] = {
+        (uint8_t) (length >> 16), (uint8_t) (length >> 8), (uint8_t) length,
+        type, flags,
+        (uint8_t) (stream_id >> 24) & 0x7F, (uint8_t) (stream_id >> 16), (uint8_t) (stream_id >> 8), (uint8_t) stream_id
+    };
+    buffer_append(buf, h, 9);
+}
+
+static inline uint32_t get_u32(uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/****************************************************************
+ * Server
+ */
+
+typedef struct {
+    uint32_t id;
+    bool ready;         // latency elapsed
+    bool headers_sent;
+    size_t offset;      // of body
+    int64_t window;
+} H2Stream;
+
+typedef struct {
+    int fd;
+    uint64_t generation;
+    Buffer in;
+    Buffer out;
+    bool closing;
+
+    // HTTP/1.1
+    unsigned responses_ready;
+    size_t response_offset;  // of the current response
+
+    // HTTP/2
+    bool preface_received;
+    int64_t window;
+    int64_t initial_window;
+    H2Stream* streams;
+    unsigned num_streams;
+    unsigned capacity;
+} Connection;
+
+typedef struct {
+    uint64_t due;
+    int fd;
+    uint64_t generation;
+    uint32_t stream_id;
+} Delayed;
+
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    Connection** connections;  // indexed by fd
+    unsigned max_fd;
+    uint64_t next_generation;
+
+    Delayed* delayed;  // min-heap by due time
+    unsigned num_delayed;
+    unsigned delayed_capacity;
+} Server;
+
+static void delayed_push(Server* server, Delayed item)
+{
+    if (server->num_delayed == server->delayed_capacity) {
+        server->delayed_capacity = server->delayed_capacity? server->delayed_capacity * 2 : 1024;
+        server->delayed = realloc(server->delayed, server->delayed_capacity * sizeof(Delayed));
+    }
+    unsigned i = server->num_delayed++;
+    server->delayed[i] = item;
+    while (i) {
+        unsigned parent = (i - 1) / 2;
+        if (server->delayed[parent].due <= server->delayed[i].due) {
+            break;
+        }
+        Delayed tmp = server->delayed[parent];
+        server->delayed[parent] = server->delayed[i];
+        server->delayed[i] = tmp;
+        i = parent;
+    }
+}
+
+static Delayed delayed_pop(Server* server)
+{
+    Delayed result = server->delayed[0];
+    server->delayed[0] = server->delayed[--server->num_delayed];
+    unsigned i = 0;
+    for (;;) {
+        unsigned first = i;
+        unsigned left = 2 * i + 1;
+        unsigned right = left + 1;
+        if (left < server->num_delayed && server->delayed[left].due < server->delayed[first].due) {
+            first = left;
+        }
+        if (right < server->num_delayed && server->delayed[right].due < server->delayed[first].due) {
+            first = right;
+        }
+        if (first == i) {
+            break;
+        }
+        Delayed tmp = server->delayed[first];
+        server->delayed[first] = server->delayed[i];
+        server->delayed[i] = tmp;
+        i = first;
+    }
+    return result;
+}
+
+static void close_connection(Server* server, Connection* conn)
+{
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    server->connections[conn->fd] = nullptr;
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->streams);
+    free(conn);
+}
+
+static H2Stream* find_stream(Connection* conn, uint32_t id)
+{
+    for (unsigned i = 0; i < conn->num_streams; i++) {
+        if (conn->streams[i].id == id) {
+            return &conn->streams[i];
+        }
+    }
+    return nullptr;
+}
+
+static void remove_stream(Connection* conn, H2Stream* stream)
+{
+    *stream = conn->streams[--conn->num_streams];
+}
+
+static void response_ready(Server* server, Connection* conn, uint32_t stream_id)
+{
+    if (!config.http2) {
+        conn->responses_ready++;
+        return;
+    }
+    H2Stream* stream = find_stream(conn, stream_id);
+    if (stream) {
+        stream->ready = true;
+    }
+}
+
+static void request_received(Server* server, Connection* conn, uint32_t stream_id)
+{
+    if (config.latency == 0) {
+        response_ready(server, conn, stream_id);
+        return;
+    }
+    delayed_push(server, (Delayed) {
+        .due        = now_ns() + config.latency * 1000000ULL,
+        .fd         = conn->fd,
+        .generation = conn->generation,
+        .stream_id  = stream_id
+    });
+}
+
+static void process_http1_input(Server* server, Connection* conn)
+{
+    for (;;) {
+        uint8_t* start = conn->in.data + conn->in.start;
+        uint8_t* end = memmem(start, buffer_length(&conn->in), "\r\n\r\n", 4);
+        if (!end) {
+            break;
+        }
+        conn->in.start += end + 4 - start;
+        request_received(server, conn, 0);
+    }
+}
+
+static void process_h2_frame(Server* server, Connection* conn, uint8_t type, uint8_t flags,
+                             uint32_t stream_id, uint8_t* payload, size_t length)
+{
+    switch (type) {
+        case H2_HEADERS:
+        case H2_CONTINUATION: {
+            if (type == H2_HEADERS) {
+                if (conn->num_streams == conn->capacity) {
+                    conn->capacity = conn->capacity? conn->capacity * 2 : 16;
+                    conn->streams = realloc(conn->streams, conn->capacity * sizeof(H2Stream));
+                }
+                conn->streams[conn->num_streams++] = (H2Stream) {
+                    .id     = stream_id,
+                    .window = conn->initial_window
+                };
+            }
+            // GET requests have END_STREAM on HEADERS, header block itself is not needed
+            H2Stream* stream = find_stream(conn, stream_id);
+            if (stream && (flags & H2_FLAG_END_HEADERS)) {
+                request_received(server, conn, stream_id);
+            }
+            break;
+        }
+        case H2_SETTINGS:
+            if (!(flags & H2_FLAG_ACK)) {
+                for (size_t i = 0; i + 6 <= length; i += 6) {
+                    unsigned id = (payload[i] << 8) | payload[i + 1];
+                    uint32_t value = get_u32(payload + i + 2);
+                    if (id == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+                        int64_t delta = (int64_t) value - conn->initial_window;
+                        for (unsigned j = 0; j < conn->num_streams; j++) {
+                            conn->streams[j].window += delta;
+                        }
+                        conn->initial_window = value;
+                    }
+                }
+                h2_frame_header(&conn->out, 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+            }
+            break;
+
+        case H2_WINDOW_UPDATE:
+            if (length >= 4) {
+                uint32_t increment = get_u32(payload) & 0x7FFFFFFF;
+                if (stream_id == 0) {
+                    conn->window += increment;
+                } else {
+                    H2Stream* stream = find_stream(conn, stream_id);
+                    if (stream) {
+                        stream->window += increment;
+                    }
+                }
+            }
+            break;
+
+        case H2_PING:
+            if (!(flags & H2_FLAG_ACK) && length == 8) {
+                h2_frame_header(&conn->out, 8, H2_PING, H2_FLAG_ACK, 0);
+                buffer_append(&conn->out, payload, 8);
+            }
+            break;
+
+        case H2_RST_STREAM: {
+            H2Stream* stream = find_stream(conn, stream_id);
+            if (stream) {
+                remove_stream(conn, stream);
+            }
+            break;
+        }
+        case H2_GOAWAY:
+            conn->closing = true;
+            break;
+
+        default:
+            // DATA and PRIORITY are ignored, GET requests have no body
+            break;
+    }
+}
+
+static void process_h2_input(Server* server, Connection* conn)
+{
+    if (!conn->preface_received) {
+        if (buffer_length(&conn->in) < sizeof(h2_preface) - 1) {
+            return;
+        }
+        if (memcmp(conn->in.data + conn->in.start, h2_preface, sizeof(h2_preface) - 1) != 0) {
+            conn->closing = true;
+            return;
+        }
+        conn->in.start += sizeof(h2_preface) - 1;
+        conn->preface_received = true;
+    }
+    while (buffer_length(&conn->in) >= 9) {
+        uint8_t* h = conn->in.data + conn->in.start;
+        size_t length = ((size_t) h[0] << 16) | (h[1] << 8) | h[2];
+        if (buffer_length(&conn->in) < 9 + length) {
+            break;
+        }
+        conn->in.start += 9 + length;
+        process_h2_frame(server, conn, h[3], h[4], get_u32(h + 5) & 0x7FFFFFFF, h + 9, length);
+    }
+}
+
+static void produce_h2_output(Connection* conn)
+/*
+ * Append frames of ready streams to output buffer as long as flow control allows.
+ */
+{
+    for (unsigned i = 0; i < conn->num_streams;) {
+        if (buffer_length(&conn->out) >= 256 * 1024) {
+            return;
+        }
+        H2Stream* stream = &conn->streams[i];
+        if (!stream->ready) {
+            i++;
+            continue;
+        }
+        if (!stream->headers_sent) {
+            uint8_t flags = H2_FLAG_END_HEADERS | ((body_size == 0)? H2_FLAG_END_STREAM : 0);
+            h2_frame_header(&conn->out, buffer_length(&h2_headers), H2_HEADERS, flags, stream->id);
+            buffer_append(&conn->out, h2_headers.data, buffer_length(&h2_headers));
+            stream->headers_sent = true;
+            if (body_size == 0) {
+                remove_stream(conn, stream);
+                continue;
+            }
+        }
+        bool done = false;
+        while (conn->window > 0 && stream->window > 0 && buffer_length(&conn->out) < 256 * 1024) {
+            size_t n = body_size - stream->offset;
+            if (n > H2_MAX_FRAME_SIZE) {
+                n = H2_MAX_FRAME_SIZE;
+            }
+            if ((int64_t) n > conn->window) {
+                n = conn->window;
+            }
+            if ((int64_t) n > stream->window) {
+                n = stream->window;
+            }
+            done = stream->offset + n == body_size;
+            h2_frame_header(&conn->out, n, H2_DATA, done? H2_FLAG_END_STREAM : 0, stream->id);
+            buffer_append(&conn->out, body + stream->offset, n);
+            stream->offset += n;
+            conn->window -= n;
+            stream->window -= n;
+            if (done) {
+                break;
+            }
+        }
+        if (done) {
+            remove_stream(conn, stream);
+        } else {
+            i++;
+        }
+    }
+}
+
+static void produce_http1_output(Connection* conn)
+{
+    while (conn->responses_ready && buffer_length(&conn->out) < 256 * 1024) {
+        size_t n = buffer_length(&http1_response) - conn->response_offset;
+        if (n > 256 * 1024) {
+            n = 256 * 1024;
+        }
+        buffer_append(&conn->out, http1_response.data + conn->response_offset, n);
+        conn->response_offset += n;
+        if (conn->response_offset == buffer_length(&http1_response)) {
+            conn->response_offset = 0;
+            conn->responses_ready--;
+        }
+    }
+}
+
+static void flush_connection(Server* server, Connection* conn)
+{
+    for (;;) {
+        if (config.http2) {
+            produce_h2_output(conn);
+        } else {
+            produce_http1_output(conn);
+        }
+        size_t length = buffer_length(&conn->out);
+        if (length == 0) {
+            break;
+        }
+        ssize_t n = send(conn->fd, conn->out.data + conn->out.start, length, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno != EAGAIN) {
+                conn->closing = true;
+            }
+            break;
+        }
+        conn->out.start += n;
+        if ((size_t) n < length) {
+            break;
+        }
+    }
+    if (conn->closing && buffer_length(&conn->out) == 0) {
+        close_connection(server, conn);
+        return;
+    }
+    struct epoll_event ev = {
+        .events  = EPOLLIN | ((buffer_length(&conn->out))? EPOLLOUT : 0),
+        .data.fd = conn->fd
+    };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void accept_connections(Server* server)
+{
+    for (;;) {
+        int fd = accept4(server->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        if ((unsigned) fd >= server->max_fd) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Connection* conn = calloc(1, sizeof(Connection));
+        conn->fd = fd;
+        conn->generation = ++server->next_generation;
+        conn->window = H2_DEFAULT_WINDOW;
+        conn->initial_window = H2_DEFAULT_WINDOW;
+        server->connections[fd] = conn;
+
+        if (config.http2) {
+            // SETTINGS: MAX_CONCURRENT_STREAMS
+            h2_frame_header(&conn->out, 6, H2_SETTINGS, 0, 0);
+            uint8_t setting[6] = { 0, 3, 0, 0, (uint8_t) (H2_MAX_STREAMS >> 8), (uint8_t) H2_MAX_STREAMS };
+            buffer_append(&conn->out, setting, 6);
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        flush_connection(server, conn);
+    }
+}
+
+static void read_connection(Server* server, Connection* conn)
+{
+    for (;;) {
+        buffer_reserve(&conn->in, 16384);
+        ssize_t n = recv(conn->fd, conn->in.data + conn->in.size, conn->in.capacity - conn->in.size, 0);
+        if (n == 0) {
+            conn->closing = true;
+            break;
+        }
+        if (n == -1) {
+            if (errno != EAGAIN) {
+                conn->closing = true;
+            }
+            break;
+        }
+        conn->in.size += n;
+    }
+    if (config.http2) {
+        process_h2_input(server, conn);
+    } else {
+        process_http1_input(server, conn);
+    }
+}
+
+static void* server_thread(void* arg)
+{
+    Server* server = (Server*) arg;
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = server->listen_fd };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev);
+
+    struct epoll_event events[256];
+    for (;;) {
+        int timeout = -1;
+        if (server->num_delayed) {
+            uint64_t now = now_ns();
+            uint64_t due = server->delayed[0].due;
+            timeout = (due > now)? (int) ((due - now + 999999) / 1000000) : 0;
+        }
+        int n = epoll_wait(server->epoll_fd, events, 256, timeout);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server->listen_fd) {
+                accept_connections(server);
+                continue;
+            }
+            Connection* conn = server->connections[fd];
+            if (!conn) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                read_connection(server, conn);
+            }
+            flush_connection(server, conn);
+        }
+        uint64_t now = now_ns();
+        while (server->num_delayed && server->delayed[0].due <= now) {
+            Delayed item = delayed_pop(server);
+            Connection* conn = server->connections[item.fd];
+            if (conn && conn->generation == item.generation) {
+                response_ready(server, conn, item.stream_id);
+                flush_connection(server, conn);
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void run_server(int listen_fd)
+{
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+
+    pthread_t threads[config.num_threads];
+    for (unsigned i = 0; i < config.num_threads; i++) {
+        Server* server = calloc(1, sizeof(Server));
+        server->listen_fd = listen_fd;
+        server->max_fd = (unsigned) rl.rlim_cur;
+        server->connections = calloc(server->max_fd, sizeof(Connection*));
+        pthread_create(&threads[i], nullptr, server_thread, server);
+    }
+    for (unsigned i = 0; i < config.num_threads; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+}
+
+static int create_listen_socket(unsigned* port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port        = 0
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(fd, (struct sockaddr*) &addr, addr_len) == -1
+        || listen(fd, 4096) == -1
+        || getsockname(fd, (struct sockaddr*) &addr, &addr_len) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/****************************************************************
+ * Client
+ */
+
+typedef struct {
+    unsigned completed;
+    unsigned failed;
+    size_t bytes;
+} ClientStats;
+
+static void request_done(void* session, UwValuePtr request, void* arg)
+{
+    ClientStats* stats = (ClientStats*) arg;
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    stats->completed++;
+    if (req->result != CURLE_OK || req->status != 200) {
+        if (stats->failed++ == 0) {
+            fprintf(stderr, "request failed: %s, status %u\n", curl_easy_strerror(req->result), req->status);
+        }
+    }
+    stats->bytes += (size_t) req->timing.size_download;
+}
+
+static bool submit_request(void* session, UwValuePtr url)
+{
+    UwValue request = _uw_create(UwTypeId_HttpRequest);
+    if (uw_error(&request)) {
+        return false;
+    }
+    http_request_set_url(&request, url);
+    return add_http_request(session, &request);
+}
+
+static void run_client(unsigned port)
+{
+    char url_cstr[64];
+    snprintf(url_cstr, sizeof(url_cstr), "http://127.0.0.1:%u/", port);
+    UwValue url = uw_create_string_cstr(url_cstr);
+
+    HttpSessionConfig session_config;
+    http_session_default_config(&session_config);
+    session_config.engine = config.epoll? HTTP_ENGINE_EPOLL : HTTP_ENGINE_POLL;
+    session_config.log_level = HTTP_LOG_OFF;
+    session_config.handle_pool_size = config.concurrency;
+    session_config.http_version = config.http2? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_1_1;
+
+    void* session = create_http_session_with_config(&session_config);
+    if (!session) {
+        fprintf(stderr, "cannot create session\n");
+        exit(1);
+    }
+    ClientStats stats = {};
+    http_session_set_done_callback(session, request_done, &stats);
+
+    unsigned submitted = 0;
+    uint64_t start = now_ns();
+    for (;;) {
+        while (submitted < config.num_requests && submitted - stats.completed < config.concurrency) {
+            if (!submit_request(session, &url)) {
+                fprintf(stderr, "cannot submit request\n");
+                exit(1);
+            }
+            submitted++;
+        }
+        if (stats.completed == config.num_requests) {
+            break;
+        }
+        int running_transfers;
+        if (!http_perform(session, &running_transfers)) {
+            exit(1);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    HttpLatencyHistogram latency[HTTP_NUM_PHASES];
+    http_session_latency_snapshot(session, latency);
+    delete_http_session(session);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+               + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    double seconds = elapsed / 1e9;
+    printf("requests:      %u (%u failed)\n", stats.completed, stats.failed);
+    printf("elapsed:       %.3f s\n", seconds);
+    printf("throughput:    %.0f req/s, %.1f MB/s\n", stats.completed / seconds, stats.bytes / seconds / 1e6);
+    printf("latency p50:   %.3f ms\n", http_histogram_percentile(&latency[HTTP_PHASE_TOTAL], 50.0) / 1000.0);
+    printf("latency p99:   %.3f ms\n", http_histogram_percentile(&latency[HTTP_PHASE_TOTAL], 99.0) / 1000.0);
+    printf("peak RSS:      %ld KB\n", usage.ru_maxrss);
+    printf("CPU/request:   %.1f us\n", cpu * 1e6 / stats.completed);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:s:l:kz2et:")) != -1) {
+        switch (opt) {
+            case 'n': config.num_requests = (unsigned) strtoul(optarg, nullptr, 10); break;
+            case 'c': config.concurrency  = (unsigned) strtoul(optarg, nullptr, 10); break;
+            case 's': config.body_size    = strtoul(optarg, nullptr, 10); break;
+            case 'l': config.latency      = (unsigned) strtoul(optarg, nullptr, 10); break;
+            case 'k': config.chunked      = true; break;
+            case 'z': config.gzip         = true; break;
+            case '2': config.http2        = true; break;
+            case 'e': config.epoll        = true; break;
+            case 't': config.num_threads  = (unsigned) strtoul(optarg, nullptr, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n requests] [-c concurrency] [-s body_size] [-l latency_ms]"
+                                " [-k] [-z] [-2] [-e] [-t server_threads]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (config.concurrency == 0) {
+        config.concurrency = 1;
+    }
+    if (config.num_threads == 0) {
+        config.num_threads = 1;
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    make_body();
+    make_http1_response();
+    make_h2_headers();
+
+    unsigned port;
+    int listen_fd = create_listen_socket(&port);
+
+    pid_t server_pid = fork();
+    if (server_pid == -1) {
+        perror("fork");
+        return 1;
+    }
+    if (server_pid == 0) {
+        run_server(listen_fd);
+        _exit(0);
+    }
+    close(listen_fd);
+
+    init_http();
+    run_client(port);
+    cleanup_http();
+
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, nullptr, 0);
+    return 0;
+}
@@ -1,12 +1,18 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
 #include <uw.h>
 
 #include "uw_http.h"
 
-// probably should be session properties:
-static bool debug = false;
-//static int max_connections = 5;  //100;
-//static int max_host_connections = 5;  //10;
-
 static char* _http_headers[] = {
     // from Tor browser:
     "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:128.0) Gecko/20100101 Firefox/128.0",
@@ -23,6 +29,159 @@ static char* _http_headers[] = {
     "Priority: u=0, i"
 };
 
+/****************************************************************
+ * Header profiles
+ */
+
+static HttpHeaderProfile header_profiles[HTTP_MAX_HEADER_PROFILES] = {};
+static unsigned num_header_profiles = 0;
+
+HttpHeaderProfile* http_get_header_profile(char* name)
+{
+    for (unsigned i = 0; i < num_header_profiles; i++) {
+        if (strcmp(header_profiles[i].name, name) == 0) {
+            return &header_profiles[i];
+        }
+    }
+    return nullptr;
+}
+
+bool http_register_header_profile(char* name, char** headers, unsigned num_headers)
+{
+    if (http_get_header_profile(name)) {
+        fprintf(stderr, "ERROR %s: header profile %s already exists\n", __func__, name);
+        return false;
+    }
+    if (num_header_profiles == HTTP_MAX_HEADER_PROFILES) {
+        fprintf(stderr, "ERROR %s: too many header profiles\n", __func__);
+        return false;
+    }
+    struct curl_slist* list = nullptr;
+    for (unsigned i = 0; i < num_headers; i++) {
+        struct curl_slist* temp = curl_slist_append(list, headers[i]);
+        if (!temp) {
+            fprintf(stderr, "Cannot make headers\n");
+            curl_slist_free_all(list);
+            return false;
+        }
+        list = temp;
+    }
+    size_t name_size = strlen(name) + 1;
+    char* profile_name = _uw_default_allocator.alloc(name_size);
+    if (!profile_name) {
+        curl_slist_free_all(list);
+        return false;
+    }
+    memcpy(profile_name, name, name_size);
+
+    HttpHeaderProfile* profile = &header_profiles[num_header_profiles++];
+    profile->name    = profile_name;
+    profile->headers = list;
+    return true;
+}
+
+static void delete_header_profiles()
+{
+    for (unsigned i = 0; i < num_header_profiles; i++) {
+        HttpHeaderProfile* profile = &header_profiles[i];
+        _uw_default_allocator.free(profile->name, strlen(profile->name) + 1);
+        curl_slist_free_all(profile->headers);
+        *profile = (HttpHeaderProfile) {};
+    }
+    num_header_profiles = 0;
+}
+
+static bool same_header_name(char* a, char* b)
+/*
+ * Compare names of two headers, case-insensitive.
+ * Names are terminated with colon, or with semicolon for empty headers.
+ */
+{
+    for (;;) {
+        char ca = *a++;
+        char cb = *b++;
+        bool end_a = ca == ':' || ca == ';' || ca == 0;
+        bool end_b = cb == ':' || cb == ';' || cb == 0;
+        if (end_a || end_b) {
+            return end_a && end_b;
+        }
+        if (tolower((unsigned char) ca) != tolower((unsigned char) cb)) {
+            return false;
+        }
+    }
+}
+
+static void free_merged_headers(HttpRequestData* req)
+{
+    if (req->headers) {
+        _uw_default_allocator.free(req->headers, req->num_headers * sizeof(struct curl_slist));
+        req->headers = nullptr;
+        req->num_headers = 0;
+    }
+}
+
+static struct curl_slist* merge_headers(HttpRequestData* req, HttpHeaderProfile* profile)
+/*
+ * Return header list for the request.
+ *
+ * If the request has no extra or conditional headers, return shared profile headers.
+ * Otherwise, make a list of nodes in a single block of memory,
+ * pointing to strings of request and profile headers.
+ * Such a list must not be freed by curl_slist_free_all.
+ */
+{
+    struct curl_slist* own_headers[2] = { req->extra_headers, req->conditional_headers };
+
+    if (!own_headers[0] && !own_headers[1]) {
+        return profile? profile->headers : nullptr;
+    }
+    free_merged_headers(req);
+
+    unsigned n = 0;
+    for (unsigned k = 0; k < 2; k++) {
+        for (struct curl_slist* h = own_headers[k]; h; h = h->next) {
+            n++;
+        }
+    }
+    if (profile) {
+        for (struct curl_slist* h = profile->headers; h; h = h->next) {
+            n++;
+        }
+    }
+    struct curl_slist* nodes = _uw_default_allocator.alloc(n * sizeof(struct curl_slist));
+    if (!nodes) {
+        return nullptr;
+    }
+    unsigned i = 0;
+    for (unsigned k = 0; k < 2; k++) {
+        for (struct curl_slist* h = own_headers[k]; h; h = h->next) {
+            nodes[i++].data = h->data;
+        }
+    }
+    if (profile) {
+        for (struct curl_slist* h = profile->headers; h; h = h->next) {
+            bool overridden = false;
+            for (unsigned k = 0; k < 2 && !overridden; k++) {
+                for (struct curl_slist* x = own_headers[k]; x; x = x->next) {
+                    if (same_header_name(h->data, x->data)) {
+                        overridden = true;
+                        break;
+                    }
+                }
+            }
+            if (!overridden) {
+                nodes[i++].data = h->data;
+            }
+        }
+    }
+    for (unsigned j = 0; j < i; j++) {
+        nodes[j].next = (j + 1 < i)? &nodes[j + 1] : nullptr;
+    }
+    req->headers = nodes;
+    req->num_headers = n;
+    return nodes;
+}
+
 /****************************************************************
  * HTTP request
  */
@@ -36,6 +195,7 @@ static void fini_http_request(UwValuePtr self)
 
     uw_destroy(&req->url);
     uw_destroy(&req->proxy);
+    uw_destroy(&req->cookie);
     uw_destroy(&req->real_url);
     uw_destroy(&req->media_type);
     uw_destroy(&req->media_subtype);
@@ -44,9 +204,19 @@ static void fini_http_request(UwValuePtr self)
     uw_destroy(&req->disposition_params);
     uw_destroy(&req->content);
 
-    if (req->headers) {
-        curl_slist_free_all(req->headers);
-        req->headers = nullptr;
+    http_sink_close(req, false);
+    http_chunk_chain_free(&req->chunks);
+
+    free_merged_headers(req);
+    http_header_index_free(&req->response_headers);
+
+    if (req->extra_headers) {
+        curl_slist_free_all(req->extra_headers);
+        req->extra_headers = nullptr;
+    }
+    if (req->conditional_headers) {
+        curl_slist_free_all(req->conditional_headers);
+        req->conditional_headers = nullptr;
     }
 
     if (req->easy_handle) {
@@ -58,65 +228,24 @@ static void fini_http_request(UwValuePtr self)
 static UwResult init_http_request(UwValuePtr self, va_list ap)
 /*
  * Basic UW interface method
- * Initialize request structure and create CURL easy handle
+ * Initialize request structure.
+ * CURL easy handle is acquired from the session when the request is added.
  */
 {
     HttpRequestData* req = (HttpRequestData*) self->extra_data;
 
     req->url     = UwString();
     req->proxy   = UwString();
+    req->cookie  = UwString();
     req->media_type    = UwString();
     req->media_subtype = UwString();
     req->media_type_params = UwMap();
-    //req->content_encoding_is_utf8 = false;
+    req->content_is_utf8 = false;
+    req->charset_unsupported = false;
     req->status  = 0;
+    req->resume_pos = 0;
     req->real_url = uw_clone(&req->url);
-
-    req->easy_handle = curl_easy_init();
-    if (!req->easy_handle) {
-        fprintf(stderr, "Cannot make CURL handle\n");
-        fini_http_request(self);
-        return UwOOM();  // XXX
-    }
-    // set self as private data for easy_handle
-    UwValuePtr self_ptr = _uw_default_allocator.alloc(sizeof(_UwValue));
-    *self_ptr = uw_clone(self);
-    curl_easy_setopt(req->easy_handle, CURLOPT_PRIVATE, self_ptr);
-
-    // make headers
-    for (size_t i = 0; i < sizeof(_http_headers)/sizeof(_http_headers[0]); i++) {
-        struct curl_slist* temp = curl_slist_append(req->headers, _http_headers[i]);
-        if (!temp) {
-            fprintf(stderr, "Cannot make headers\n");
-            fini_http_request(self);
-            return UwOOM();
-        }
-        req->headers = temp;
-    }
-    curl_easy_setopt(req->easy_handle, CURLOPT_HTTPHEADER, req->headers);
-
-    // other essentials
-    curl_easy_setopt(req->easy_handle, CURLOPT_ACCEPT_ENCODING, "gzip, deflate, br, zstd");
-    curl_easy_setopt(req->easy_handle, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
-
-    curl_easy_setopt(req->easy_handle, CURLOPT_TIMEOUT, 1200L);
-    curl_easy_setopt(req->easy_handle, CURLOPT_CONNECTTIMEOUT, 60L);
-    curl_easy_setopt(req->easy_handle, CURLOPT_EXPECT_100_TIMEOUT_MS, 0L);
-
-    curl_easy_setopt(req->easy_handle, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(req->easy_handle, CURLOPT_MAXREDIRS, 10L);
-    curl_easy_setopt(req->easy_handle, CURLOPT_REDIR_PROTOCOLS_STR, "http,https");
-    curl_easy_setopt(req->easy_handle, CURLOPT_AUTOREFERER, 1L);
-
-    if (debug) {
-        curl_easy_setopt(req->easy_handle, CURLOPT_VERBOSE, 1L);
-    }
-
-    // set write function
-    UwInterface_Curl* iface = uw_get_interface(self, Curl);
-
-    curl_easy_setopt(req->easy_handle, CURLOPT_WRITEFUNCTION, iface->write_data);
-    curl_easy_setopt(req->easy_handle, CURLOPT_WRITEDATA, self_ptr);
+    req->sink = (HttpBodySink) { .type = HTTP_SINK_MEMORY, .fd = -1 };
 
     // python leftovers to do someday:
     //
@@ -132,33 +261,38 @@ static size_t request_write_data(void* data, size_t always_1, size_t size, UwVal
 {
     HttpRequestData* req = (HttpRequestData*) self->extra_data;
 
-    if (uw_is_null(&req->content)) {
-        http_request_parse_headers(req);
-
-        curl_off_t content_length;
-        CURLcode res = curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
-        if (res != CURLE_OK || content_length < 0) {
-            content_length = 0;
-        }
-        req->content = uw_create_empty_string(content_length, 1);
-        if (uw_error(&req->content)) {
+    if (!req->sink.opened) {
+        if (!http_sink_open(req)) {
             return 0;
         }
     }
     if (!size) {
         return 0;
     }
-    if (!uw_string_append_buffer(&req->content, (uint8_t*) data, size)) {
+    if (req->decode_charset && !req->raw_content) {
+        return http_charset_write(req, (uint8_t*) data, size);
+    }
+    return http_sink_write(req, (uint8_t*) data, size);
+}
+
+static size_t request_header_data(char* data, size_t always_1, size_t size, UwValuePtr self)
+{
+    HttpRequestData* req = (HttpRequestData*) self->extra_data;
+
+    if (!http_header_index_add(&req->response_headers, data, size)) {
         return 0;
     }
     return size;
 }
 
 static void request_complete(UwValuePtr self)
+/*
+ * Headers are parsed on demand, unless the request asks for them here.
+ */
 {
     HttpRequestData* req = (HttpRequestData*) self->extra_data;
 
-    if (uw_is_null(&req->content)) {
+    if (req->parse_headers_on_complete) {
         http_request_parse_headers(req);
     }
 }
@@ -167,8 +301,6 @@ void http_request_set_url(UwValuePtr request, UwValuePtr url)
 {
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
-    UW_CSTRING_LOCAL(url_cstr, url);
-    curl_easy_setopt(req->easy_handle, CURLOPT_URL, url_cstr);
     uw_destroy(&req->url);
     req->url = uw_clone(url);
 }
@@ -181,8 +313,6 @@ void http_request_set_proxy(UwValuePtr request, UwValuePtr proxy)
 
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
-    UW_CSTRING_LOCAL(proxy_cstr, proxy);
-    curl_easy_setopt(req->easy_handle, CURLOPT_PROXY, proxy_cstr);
     uw_destroy(&req->proxy);
     req->proxy = uw_clone(proxy);
 }
@@ -195,25 +325,56 @@ void http_request_set_cookie(UwValuePtr request, UwValuePtr cookie)
 
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
-    UW_CSTRING_LOCAL(cookie_cstr, cookie);
-    curl_easy_setopt(req->easy_handle, CURLOPT_COOKIE, cookie_cstr);
+    uw_destroy(&req->cookie);
+    req->cookie = uw_clone(cookie);
+}
+
+void http_request_set_parse_headers(UwValuePtr request, bool on_complete)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    req->parse_headers_on_complete = on_complete;
 }
 
 void http_request_set_resume(UwValuePtr request, size_t pos)
 {
-    if (pos == 0) {
-        return;
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    req->resume_pos = pos;
+}
+
+bool http_request_set_header_profile(UwValuePtr request, char* profile_name)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    HttpHeaderProfile* profile = http_get_header_profile(profile_name);
+    if (!profile) {
+        fprintf(stderr, "ERROR %s: header profile %s does not exist\n", __func__, profile_name);
+        return false;
     }
+    req->header_profile = profile;
+    return true;
+}
 
+bool http_request_add_header(UwValuePtr request, char* header)
+{
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
-    curl_easy_setopt(req->easy_handle, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) pos);
+    struct curl_slist* temp = curl_slist_append(req->extra_headers, header);
+    if (!temp) {
+        return false;
+    }
+    req->extra_headers = temp;
+    return true;
 }
 
 void http_update_status(UwValuePtr request)
 {
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
+    if (!req->easy_handle) {
+        return;
+    }
     long status;
     CURLcode err = curl_easy_getinfo(req->easy_handle, CURLINFO_RESPONSE_CODE, &status);
     if (err) {
@@ -242,6 +403,13 @@ void init_http()
     // init CURL
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    // build default headers
+    if (!http_register_header_profile(HTTP_DEFAULT_HEADER_PROFILE, _http_headers,
+                                      sizeof(_http_headers)/sizeof(_http_headers[0]))) {
+        fprintf(stderr, "Failed creating default header profile\n");
+        exit(1);
+    }
+
     // create HTTP request subtype
     UwTypeId_HttpRequest = uw_subtype(
         &http_request_type, "HTTPRequest",
@@ -261,10 +429,14 @@ void init_http()
         exit(1);
     }
     http_request_type.interfaces[UwInterfaceId_Curl] = &curl_interface;
+
+    init_url_base_type();
 }
 
 void cleanup_http()
 {
+    http_chunk_pool_trim();
+    delete_header_profiles();
     curl_global_cleanup();
 }
 
@@ -272,48 +444,701 @@ void cleanup_http()
  * CURL sessions and runner
  */
 
+static void set_default_options(HttpSession* session, CURL* easy_handle)
+/*
+ * Set options common for all requests.
+ * Called for new handles and for handles returned to the pool.
+ */
+{
+    HttpSessionConfig* config = &session->config;
+
+    curl_easy_setopt(easy_handle, CURLOPT_ACCEPT_ENCODING, "gzip, deflate, br, zstd");
+    curl_easy_setopt(easy_handle, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
+
+    curl_easy_setopt(easy_handle, CURLOPT_TIMEOUT, config->timeout);
+    curl_easy_setopt(easy_handle, CURLOPT_CONNECTTIMEOUT, config->connect_timeout);
+    curl_easy_setopt(easy_handle, CURLOPT_EXPECT_100_TIMEOUT_MS, 0L);
+
+    curl_easy_setopt(easy_handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy_handle, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(easy_handle, CURLOPT_REDIR_PROTOCOLS_STR, "http,https");
+    curl_easy_setopt(easy_handle, CURLOPT_AUTOREFERER, 1L);
+
+    if (config->verbose) {
+        curl_easy_setopt(easy_handle, CURLOPT_VERBOSE, 1L);
+    }
+    if (config->http_version != CURL_HTTP_VERSION_NONE) {
+        curl_easy_setopt(easy_handle, CURLOPT_HTTP_VERSION, config->http_version);
+    }
+    // always set, curl_easy_reset does not drop the share and a detached one may be deleted
+    curl_easy_setopt(easy_handle, CURLOPT_SHARE, session->shared_cache? session->shared_cache->share : nullptr);
+}
+
+static CURL* acquire_easy_handle(HttpSession* session)
+{
+    HttpHandlePool* pool = &session->handle_pool;
+
+    if (pool->count) {
+        pool->hits++;
+        return pool->handles[--pool->count];
+    }
+    pool->misses++;
+
+    CURL* easy_handle = curl_easy_init();
+    if (easy_handle) {
+        set_default_options(session, easy_handle);
+    }
+    return easy_handle;
+}
+
+static void release_easy_handle(HttpSession* session, CURL* easy_handle)
+{
+    HttpHandlePool* pool = &session->handle_pool;
+
+    if (pool->count < pool->max_size) {
+        // reset drops per-request options but retains connections, DNS and TLS session caches
+        curl_easy_reset(easy_handle);
+        set_default_options(session, easy_handle);
+        pool->handles[pool->count++] = easy_handle;
+    } else {
+        curl_easy_cleanup(easy_handle);
+    }
+}
+
+static void reconfigure_idle_handles(HttpSession* session)
+{
+    HttpHandlePool* pool = &session->handle_pool;
+    for (unsigned i = 0; i < pool->count; i++) {
+        curl_easy_reset(pool->handles[i]);
+        set_default_options(session, pool->handles[i]);
+    }
+}
+
+void http_session_set_handle_pool_size(void* session, unsigned max_size)
+{
+    HttpSession* sess = (HttpSession*) session;
+    HttpHandlePool* pool = &sess->handle_pool;
+
+    CURL** handles = nullptr;
+    if (max_size) {
+        handles = _uw_default_allocator.alloc(max_size * sizeof(CURL*));
+        if (!handles) {
+            fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+            return;
+        }
+    }
+    while (pool->count > max_size) {
+        curl_easy_cleanup(pool->handles[--pool->count]);
+    }
+    for (unsigned i = 0; i < pool->count; i++) {
+        handles[i] = pool->handles[i];
+    }
+    if (pool->handles) {
+        _uw_default_allocator.free(pool->handles, pool->max_size * sizeof(CURL*));
+    }
+    pool->handles  = handles;
+    pool->max_size = max_size;
+    sess->config.handle_pool_size = max_size;
+}
+
+static int epoll_socket_callback(CURL* easy_handle, curl_socket_t sock, int what, void* userp, void* socketp)
+/*
+ * CURLMOPT_SOCKETFUNCTION for the epoll engine.
+ * socketp is non-null when the socket is already in the epoll set.
+ */
+{
+    HttpSession* session = (HttpSession*) userp;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (socketp) {
+            epoll_ctl(session->epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+            curl_multi_assign(session->multi_handle, sock, nullptr);
+        }
+        return 0;
+    }
+    struct epoll_event ev = {};
+    ev.data.fd = sock;
+    if (what & CURL_POLL_IN) {
+        ev.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        ev.events |= EPOLLOUT;
+    }
+    int op = socketp? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(session->epoll_fd, op, sock, &ev) == -1) {
+        perror(__func__);
+        return -1;
+    }
+    if (!socketp) {
+        curl_multi_assign(session->multi_handle, sock, session);
+    }
+    return 0;
+}
+
+static int epoll_timer_callback(CURLM* multi_handle, long timeout_ms, void* userp)
+/*
+ * CURLMOPT_TIMERFUNCTION for the epoll engine.
+ */
+{
+    HttpSession* session = (HttpSession*) userp;
+
+    struct itimerspec its = {};
+    if (timeout_ms > 0) {
+        its.it_value.tv_sec  = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    } else if (timeout_ms == 0) {
+        // expire as soon as possible, calling curl_multi_socket_action from here is not allowed
+        its.it_value.tv_nsec = 1;
+    }
+    // otherwise, timeout_ms is -1 and zero value disarms the timer
+    if (timerfd_settime(session->timer_fd, 0, &its, nullptr) == -1) {
+        perror(__func__);
+        return -1;
+    }
+    return 0;
+}
+
+static bool init_epoll_engine(HttpSession* session)
+{
+    session->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (session->epoll_fd == -1) {
+        perror(__func__);
+        return false;
+    }
+    session->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (session->timer_fd == -1) {
+        perror(__func__);
+        return false;
+    }
+    session->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (session->wakeup_fd == -1) {
+        perror(__func__);
+        return false;
+    }
+    int fds[2] = { session->timer_fd, session->wakeup_fd };
+    for (unsigned i = 0; i < 2; i++) {
+        struct epoll_event ev = {};
+        ev.events  = EPOLLIN;
+        ev.data.fd = fds[i];
+        if (epoll_ctl(session->epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) == -1) {
+            perror(__func__);
+            return false;
+        }
+    }
+    curl_multi_setopt(session->multi_handle, CURLMOPT_SOCKETFUNCTION, epoll_socket_callback);
+    curl_multi_setopt(session->multi_handle, CURLMOPT_SOCKETDATA, session);
+    curl_multi_setopt(session->multi_handle, CURLMOPT_TIMERFUNCTION, epoll_timer_callback);
+    curl_multi_setopt(session->multi_handle, CURLMOPT_TIMERDATA, session);
+    return true;
+}
+
+static void fini_epoll_engine(HttpSession* session)
+{
+    if (session->wakeup_fd != -1) {
+        close(session->wakeup_fd);
+        session->wakeup_fd = -1;
+    }
+    if (session->timer_fd != -1) {
+        close(session->timer_fd);
+        session->timer_fd = -1;
+    }
+    if (session->epoll_fd != -1) {
+        close(session->epoll_fd);
+        session->epoll_fd = -1;
+    }
+}
+
+void http_session_default_config(HttpSessionConfig* config)
+{
+    *config = (HttpSessionConfig) {
+        .engine                 = HTTP_ENGINE_POLL,
+        .log_level              = HTTP_LOG_INFO,
+        .log_file               = nullptr,
+        .max_total_connections  = 0,
+        .max_host_connections   = 0,
+        .max_concurrent_streams = 100,
+        .max_connects           = 0,
+        .timeout                = 1200,
+        .connect_timeout        = 60,
+        .verbose                = false,
+        .http_version           = CURL_HTTP_VERSION_NONE,
+        .handle_pool_size       = HTTP_DEFAULT_HANDLE_POOL_SIZE
+    };
+}
+
+static bool set_multi_option(HttpSession* session, CURLMoption option, long value)
+{
+    CURLMcode err = curl_multi_setopt(session->multi_handle, option, value);
+    if (err) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, curl_multi_strerror(err));
+        return false;
+    }
+    return true;
+}
+
+bool http_session_configure(void* session, HttpSessionConfig* config)
+/*
+ * Multi options are set first and the config is stored only if all of them succeed,
+ * so http_session_get_config never reports limits that were not set.
+ */
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    if (!set_multi_option(sess, CURLMOPT_MAX_TOTAL_CONNECTIONS, config->max_total_connections)) {
+        return false;
+    }
+    if (!set_multi_option(sess, CURLMOPT_MAX_HOST_CONNECTIONS, config->max_host_connections)) {
+        return false;
+    }
+#   if LIBCURL_VERSION_NUM >= 0x074300
+        if (!set_multi_option(sess, CURLMOPT_MAX_CONCURRENT_STREAMS, config->max_concurrent_streams)) {
+            return false;
+        }
+#   endif
+    if (config->max_connects) {
+        if (!set_multi_option(sess, CURLMOPT_MAXCONNECTS, config->max_connects)) {
+            return false;
+        }
+    }
+
+    if (config->log_level != HTTP_LOG_OFF && !sess->log_ring) {
+        // the ring is never freed until the session is deleted, consumers may hold it
+        sess->log_ring = http_create_log_ring();
+        if (!sess->log_ring) {
+            return false;
+        }
+    }
+    // restart the log thread if the file has changed, stop it if logging is off
+    bool log_thread_needed = config->log_level != HTTP_LOG_OFF && config->log_file;
+    if (sess->log_thread_started && (!log_thread_needed || sess->log_file != config->log_file)) {
+        http_session_stop_log_thread(sess);
+    }
+    if (log_thread_needed && !sess->log_thread_started) {
+        if (!http_session_start_log_thread(sess, config->log_file)) {
+            return false;
+        }
+    }
+    HttpSessionEngine engine = sess->config.engine;
+    sess->config = *config;
+    sess->config.engine = engine;
+    sess->config.log_file = sess->log_thread_started? sess->log_file : nullptr;
+
+    reconfigure_idle_handles(sess);
+
+    if (config->handle_pool_size != sess->handle_pool.max_size) {
+        http_session_set_handle_pool_size(sess, config->handle_pool_size);
+    }
+    return true;
+}
+
+void http_session_get_config(void* session, HttpSessionConfig* config)
+{
+    *config = ((HttpSession*) session)->config;
+}
+
 void* create_http_session()
 {
-    CURLM* multi_handle = curl_multi_init();
+    HttpSessionConfig config;
+    http_session_default_config(&config);
+    return create_http_session_with_config(&config);
+}
+
+void* create_http_session_with_engine(HttpSessionEngine engine)
+{
+    HttpSessionConfig config;
+    http_session_default_config(&config);
+    config.engine = engine;
+    return create_http_session_with_config(&config);
+}
+
+void* create_http_session_with_config(HttpSessionConfig* config)
+{
+    HttpSession* session = _uw_default_allocator.alloc(sizeof(HttpSession));
+    if (!session) {
+        return nullptr;
+    }
+    *session = (HttpSession) {
+        .config   = *config,
+        .epoll_fd  = -1,
+        .timer_fd  = -1,
+        .wakeup_fd = -1
+    };
+
+    session->multi_handle = curl_multi_init();
+    if (!session->multi_handle) {
+        _uw_default_allocator.free(session, sizeof(HttpSession));
+        return nullptr;
+    }
 
 #   ifdef CURLPIPE_MULTIPLEX
         // enables http/2
-        curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(session->multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 #   endif
 
-    return (void*) multi_handle;
+    if (config->engine == HTTP_ENGINE_EPOLL) {
+        if (!init_epoll_engine(session)) {
+            delete_http_session(session);
+            return nullptr;
+        }
+    }
+
+    session->header_profile = http_get_header_profile(HTTP_DEFAULT_HEADER_PROFILE);
+
+    if (!http_session_configure(session, config)) {
+        delete_http_session(session);
+        return nullptr;
+    }
+    return (void*) session;
+}
+
+void http_session_attach_shared_cache(void* session, HttpSharedCache* cache)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    sess->shared_cache = cache;
+    reconfigure_idle_handles(sess);
+}
+
+void http_session_set_disk_cache(void* session, HttpDiskCache* cache)
+{
+    ((HttpSession*) session)->disk_cache = cache;
+}
+
+void http_session_set_memory_cache(void* session, HttpMemoryCache* cache)
+{
+    ((HttpSession*) session)->memory_cache = cache;
+}
+
+unsigned http_session_drain(void* session, UwValuePtr out_list, unsigned max)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    unsigned n = 0;
+    while (n < max && sess->finished.count) {
+        UwValue request = http_value_queue_pop(&sess->finished);
+        if (!uw_list_append(out_list, &request)) {
+            // put it back, this breaks the order but saves the request
+            http_value_queue_push(&sess->finished, &request);
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+void http_session_set_done_callback(void* session, HttpSessionDone callback, void* arg)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    sess->on_done = callback;
+    sess->on_done_arg = arg;
+}
+
+void http_session_wakeup(void* session)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    if (sess->config.engine == HTTP_ENGINE_EPOLL) {
+        uint64_t one = 1;
+        if (write(sess->wakeup_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror(__func__);
+        }
+    } else {
+        curl_multi_wakeup(sess->multi_handle);
+    }
+}
+
+bool http_session_set_header_profile(void* session, char* profile_name)
+{
+    HttpHeaderProfile* profile = http_get_header_profile(profile_name);
+    if (!profile) {
+        fprintf(stderr, "ERROR %s: header profile %s does not exist\n", __func__, profile_name);
+        return false;
+    }
+    ((HttpSession*) session)->header_profile = profile;
+    return true;
 }
 
 void delete_http_session(void* session)
 {
-    CURLM* multi_handle = (CURLM*) session;
+    HttpSession* sess = (HttpSession*) session;
 
-    CURLMcode err = curl_multi_cleanup(multi_handle);
+    CURLMcode err = curl_multi_cleanup(sess->multi_handle);
     if (err) {
         fprintf(stderr, "ERROR %s: %s\n", __func__, curl_multi_strerror(err));
     }
+    http_pending_fini(&sess->pending);
+    http_host_scheduler_fini(&sess->hosts);
+    http_value_queue_fini(&sess->finished);
+    http_value_queue_fini(&sess->cache_hits);
+    http_session_stop_log_thread(sess);
+    if (sess->log_ring) {
+        http_delete_log_ring(sess->log_ring);
+    }
+    fini_epoll_engine(sess);
+    http_session_set_handle_pool_size(sess, 0);
+    _uw_default_allocator.free(sess, sizeof(HttpSession));
 }
 
-bool add_http_request(void* session, UwValuePtr request)
+static bool start_transfer(HttpSession* sess, UwValuePtr request)
+/*
+ * Acquire easy handle for the request and add it to multi handle.
+ */
 {
-    CURLM* multi_handle = (CURLM*) session;
     HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
-    CURLMcode err = curl_multi_add_handle(multi_handle, req->easy_handle);
+    req->easy_handle = acquire_easy_handle(sess);
+    if (!req->easy_handle) {
+        fprintf(stderr, "Cannot make CURL handle\n");
+        return false;
+    }
+
+    // make the request conditional if the response is in the disk cache
+    if (!http_disk_cache_prepare(sess->disk_cache, req)) {
+        fprintf(stderr, "Cannot make conditional headers\n");
+        release_easy_handle(sess, req->easy_handle);
+        req->easy_handle = nullptr;
+        return false;
+    }
+
+    HttpHeaderProfile* profile = req->header_profile? req->header_profile : sess->header_profile;
+    struct curl_slist* headers = merge_headers(req, profile);
+    if ((req->extra_headers || req->conditional_headers) && !headers) {
+        fprintf(stderr, "Cannot make headers\n");
+        release_easy_handle(sess, req->easy_handle);
+        req->easy_handle = nullptr;
+        return false;
+    }
+
+    // set self as private data for easy_handle
+    UwValuePtr self_ptr = _uw_default_allocator.alloc(sizeof(_UwValue));
+    if (!self_ptr) {
+        release_easy_handle(sess, req->easy_handle);
+        req->easy_handle = nullptr;
+        return false;
+    }
+    *self_ptr = uw_clone(request);
+    curl_easy_setopt(req->easy_handle, CURLOPT_PRIVATE, self_ptr);
+
+    // set write function
+    UwInterface_Curl* iface = uw_get_interface(request, Curl);
+
+    curl_easy_setopt(req->easy_handle, CURLOPT_WRITEFUNCTION, iface->write_data);
+    curl_easy_setopt(req->easy_handle, CURLOPT_WRITEDATA, self_ptr);
+
+    // capture response headers
+    http_header_index_reset(&req->response_headers);
+    req->content_type_view = (HttpHeaderView) {};
+    req->disposition_view  = (HttpHeaderView) {};
+    req->parsed_headers = 0;
+    curl_easy_setopt(req->easy_handle, CURLOPT_HEADERFUNCTION, request_header_data);
+    curl_easy_setopt(req->easy_handle, CURLOPT_HEADERDATA, self_ptr);
+
+    // apply request options
+    curl_easy_setopt(req->easy_handle, CURLOPT_HTTPHEADER, headers);
+    {
+        UW_CSTRING_LOCAL(url_cstr, &req->url);
+        curl_easy_setopt(req->easy_handle, CURLOPT_URL, url_cstr);
+    }
+    if (uw_strlen(&req->proxy)) {
+        UW_CSTRING_LOCAL(proxy_cstr, &req->proxy);
+        curl_easy_setopt(req->easy_handle, CURLOPT_PROXY, proxy_cstr);
+    }
+    if (uw_strlen(&req->cookie)) {
+        UW_CSTRING_LOCAL(cookie_cstr, &req->cookie);
+        curl_easy_setopt(req->easy_handle, CURLOPT_COOKIE, cookie_cstr);
+    }
+    if (req->resume_pos) {
+        curl_easy_setopt(req->easy_handle, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) req->resume_pos);
+    }
+    req->content_encoding = HTTP_ENCODING_IDENTITY;
+    req->content_is_utf8 = false;
+    req->charset_unsupported = false;
+    if (req->raw_content) {
+        // Accept-Encoding is still sent, the body is kept as received
+        curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_CONTENT_DECODING, 0L);
+    }
+
+    CURLMcode err = curl_multi_add_handle(sess->multi_handle, req->easy_handle);
     if (err) {
         fprintf(stderr, "ERROR: %s\n", curl_multi_strerror(err));
+        release_easy_handle(sess, req->easy_handle);
+        req->easy_handle = nullptr;
+        uw_destroy(self_ptr);
+        _uw_default_allocator.free(self_ptr, sizeof(_UwValue));
         return false;
     } else {
+        sess->active_transfers++;
         return true;
     }
 }
 
-static void check_transfers(CURLM* multi_handle)
+static void finish_request(HttpSession* session, UwValuePtr request)
+/*
+ * Pass finished request to the done callback and the queue of finished requests,
+ * then destroy it unless the callback took it.
+ */
+{
+    if (session->on_done) {
+        session->on_done(session, request, session->on_done_arg);
+    }
+    if (session->config.collect_finished && !uw_is_null(request)) {
+        if (!http_value_queue_push(&session->finished, request)) {
+            fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+        }
+    }
+    uw_destroy(request);
+}
+
+static inline bool host_limits_enabled(HttpSessionConfig* config)
+{
+    return config->host_rate > 0.0 || config->max_host_transfers;
+}
+
+static void release_host(HttpSession* session, HttpRequestData* req)
+{
+    if (req->host) {
+        http_host_finished(&session->hosts, req->host, &session->config);
+        req->host = nullptr;
+    }
+}
+
+static void fail_request(HttpSession* session, UwValuePtr request, CURLcode result)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+    req->result = result;
+    release_host(session, req);
+    if (session->config.log_level >= HTTP_LOG_ERROR) {
+        http_log_event(session->log_ring, HTTP_LOG_ERROR, req);
+    }
+    finish_request(session, request);
+}
+
+static void start_request(HttpSession* session, UwValuePtr request)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+    if (req->host) {
+        http_host_started(req->host, &session->config);
+    }
+    if (!start_transfer(session, request)) {
+        fail_request(session, request, CURLE_FAILED_INIT);
+    }
+}
+
+static void admit_pending_requests(HttpSession* session)
+/*
+ * Start pending requests while there's room for them.
+ * Requests deferred by per-host limits go first, when their hosts are ready.
+ */
+{
+    unsigned max_active = session->config.max_active_transfers;
+
+    http_host_advance_wheel(&session->hosts, &session->config);
+
+    while (max_active == 0 || session->active_transfers < max_active) {
+        UwValue request = http_host_take_ready(&session->hosts, &session->config);
+        if (uw_is_null(&request)) {
+            if (session->pending.count == 0) {
+                break;
+            }
+            request = http_pending_pop(&session->pending);
+
+            if (host_limits_enabled(&session->config)) {
+                HttpRequestData* req = (HttpRequestData*) request.extra_data;
+                if (!req->host) {
+                    UW_CSTRING_LOCAL(url_cstr, &req->url);
+                    req->host = http_host_lookup(&session->hosts, url_cstr);
+                }
+                if (req->host && !http_host_admit(req->host, &session->config)) {
+                    if (!http_host_defer(&session->hosts, req->host, &request, &session->config)) {
+                        fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+                        req->host = nullptr;
+                        fail_request(session, &request, CURLE_OUT_OF_MEMORY);
+                    }
+                    continue;
+                }
+            }
+        }
+        start_request(session, &request);
+    }
+}
+
+static unsigned queued_requests(HttpSession* session)
+{
+    return session->pending.count + session->hosts.deferred + session->cache_hits.count;
+}
+
+static void finish_cache_hits(HttpSession* session)
+/*
+ * Finish requests served from the memory cache.
+ * Those added by done callbacks meanwhile are left for the next call.
+ */
+{
+    for (unsigned n = session->cache_hits.count; n; n--) {
+        UwValue request = http_value_queue_pop(&session->cache_hits);
+        HttpRequestData* req = (HttpRequestData*) request.extra_data;
+
+        if (session->config.log_level >= HTTP_LOG_INFO) {
+            http_log_event(session->log_ring, HTTP_LOG_INFO, req);
+        }
+        UwInterface_Curl* iface = uw_get_interface(&request, Curl);
+        iface->complete(&request);
+
+        finish_request(session, &request);
+    }
+}
+
+static int wait_timeout(HttpSession* session)
+/*
+ * Wait no longer than the next host leaves timer wheel.
+ */
+{
+    int timeout = http_host_wheel_timeout(&session->hosts);
+    return (timeout >= 0 && timeout < 1000)? timeout : 1000;
+}
+
+bool add_http_request(void* session, UwValuePtr request)
+{
+    return add_http_request_with_priority(session, request, HTTP_PRIORITY_NORMAL);
+}
+
+bool add_http_request_with_priority(void* session, UwValuePtr request, int priority)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    HttpRequestData* data = (HttpRequestData*) request->extra_data;
+    if (sess->memory_cache
+        && http_memory_cache_lookup(sess->memory_cache, data,
+                                    data->header_profile? data->header_profile : sess->header_profile)) {
+        // fresh response is in the memory cache, finish the request without CURL
+        UwValue req = uw_clone(request);
+        if (!http_value_queue_push(&sess->cache_hits, &req)) {
+            fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+            return false;
+        }
+        return true;
+    }
+
+    unsigned max_active = sess->config.max_active_transfers;
+    if (!host_limits_enabled(&sess->config)
+        && (max_active == 0 || (sess->pending.count == 0 && sess->active_transfers < max_active))) {
+        return start_transfer(sess, request);
+    }
+    UwValue req = uw_clone(request);
+    if (!http_pending_push(&sess->pending, &req, priority)) {
+        fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+        return false;
+    }
+    admit_pending_requests(sess);
+    return true;
+}
+
+static void check_transfers(HttpSession* session)
 {
     for(;;) {
         // check transfers
         int msgs_left;
-        CURLMsg *m = curl_multi_info_read(multi_handle, &msgs_left);
+        CURLMsg *m = curl_multi_info_read(session->multi_handle, &msgs_left);
         if (!m) {
             break;
         }
@@ -331,9 +1156,31 @@ static void check_transfers(CURLM* multi_handle)
 
         HttpRequestData* req = (HttpRequestData*) request->extra_data;
 
+        req->result = m->data.result;
+        http_request_update_timing(req);
+        http_sink_close(req, m->data.result == CURLE_OK);
+
+        if (m->data.result == CURLE_OK) {
+            http_update_status(request);
+            if (session->disk_cache) {
+                // store the body from chunks, or fill content of 304 response
+                http_disk_cache_complete(session->disk_cache, req);
+            }
+        }
+        if (req->raw_content) {
+            req->content_encoding = http_parse_content_encoding(http_response_header(req, "Content-Encoding"));
+        }
+        if (req->sink.type == HTTP_SINK_MEMORY && req->sink.opened
+            && uw_is_null(&req->content) && !req->segmented_content && !req->raw_content) {
+            // content of unknown length was received in chunks,
+            // raw content is left there for http_request_decode_content
+            req->content = http_chunk_chain_flatten(&req->chunks);
+        }
+
         if(m->data.result != CURLE_OK) {
-            UW_CSTRING_LOCAL(url_cstr, &req->url);
-            fprintf(stderr, "FAILED %s: %s\n", url_cstr, curl_easy_strerror(m->data.result));
+            if (session->config.log_level >= HTTP_LOG_ERROR) {
+                http_log_event(session->log_ring, HTTP_LOG_ERROR, req);
+            }
         } else {
             // get real URL
             char* url = nullptr;
@@ -342,46 +1189,130 @@ static void check_transfers(CURLM* multi_handle)
                 uw_destroy(&req->real_url);
                 req->real_url = uw_create_string_cstr(url);
             }
-            // get response status
-            http_update_status(request);
-            {
-                UW_CSTRING_LOCAL(url_cstr, &req->url);
-                fprintf(stderr, "STATUS %u: %s\n", req->status, url_cstr);
+            http_session_record_timing(session, req);
+
+            if (session->memory_cache) {
+                http_memory_cache_store(session->memory_cache, req,
+                                        req->header_profile? req->header_profile : session->header_profile);
+            }
+            if (session->shared_cache) {
+                http_shared_cache_update_stats(session->shared_cache, req->easy_handle);
+            }
+            if (session->config.log_level >= HTTP_LOG_INFO) {
+                http_log_event(session->log_ring, HTTP_LOG_INFO, req);
             }
 
             UwInterface_Curl* iface = uw_get_interface(request, Curl);
             iface->complete(request);
         }
-        curl_multi_remove_handle(multi_handle, req->easy_handle);
-        uw_destroy(request);
+        curl_multi_remove_handle(session->multi_handle, req->easy_handle);
+        session->active_transfers--;
+        release_easy_handle(session, req->easy_handle);
+        req->easy_handle = nullptr;
+        release_host(session, req);
+
+        finish_request(session, request);
         _uw_default_allocator.free(request, sizeof(_UwValue));
     }
+    admit_pending_requests(session);
+}
+
+static bool epoll_perform(HttpSession* session, int* running_transfers)
+/*
+ * Wait for ready sockets or expired timer and pass them to CURL.
+ */
+{
+    if (session->active_transfers == 0 && session->hosts.wheel_count == 0) {
+        *running_transfers = (int) queued_requests(session);
+        return true;
+    }
+
+    struct epoll_event events[HTTP_EPOLL_MAX_EVENTS];
+    int n = epoll_wait(session->epoll_fd, events, HTTP_EPOLL_MAX_EVENTS, wait_timeout(session));
+    if (n == -1) {
+        if (errno != EINTR) {
+            fprintf(stderr, "FATAL %s:%s:%d: %s\n", __FILE__, __func__, __LINE__, strerror(errno));
+            return false;
+        }
+        n = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        CURLMcode err;
+        int fd = events[i].data.fd;
+        if (fd == session->wakeup_fd) {
+            uint64_t count;
+            if (read(session->wakeup_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                perror(__func__);
+            }
+            continue;
+        }
+        if (fd == session->timer_fd) {
+            uint64_t expirations;
+            if (read(session->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                perror(__func__);
+            }
+            err = curl_multi_socket_action(session->multi_handle, CURL_SOCKET_TIMEOUT, 0, &session->still_running);
+        } else {
+            int flags = 0;
+            if (events[i].events & EPOLLIN) {
+                flags |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flags |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                flags |= CURL_CSELECT_ERR;
+            }
+            err = curl_multi_socket_action(session->multi_handle, fd, flags, &session->still_running);
+        }
+        if (err) {
+            fprintf(stderr, "FATAL %s:%s:%d: %s\n", __FILE__, __func__, __LINE__, curl_multi_strerror(err));
+            return false;
+        }
+    }
+    if (n) {
+        check_transfers(session);
+    }
+    *running_transfers = (int) (session->active_transfers + queued_requests(session));
+    return true;
 }
 
 bool http_perform(void* session, int* running_transfers)
 {
-    CURLM* multi_handle = (CURLM*) session;
+    HttpSession* sess = (HttpSession*) session;
     CURLMcode err;
 
-    err = curl_multi_perform(multi_handle, running_transfers);
+    finish_cache_hits(sess);
+
+    // start requests left pending if session limits have changed
+    // and those whose hosts are out of timer wheel
+    admit_pending_requests(sess);
+
+    if (sess->config.engine == HTTP_ENGINE_EPOLL) {
+        return epoll_perform(sess, running_transfers);
+    }
+
+    err = curl_multi_perform(sess->multi_handle, running_transfers);
     if (err) {
         fprintf(stderr, "FATAL %s:%s:%d: %s\n", __FILE__, __func__, __LINE__, curl_multi_strerror(err));
         return false;
     }
-    if (!*running_transfers) {
+    if (!*running_transfers && sess->hosts.wheel_count == 0) {
         // handles for completed requests do not appear here,
         // check them before exiting:
-        check_transfers(multi_handle);
+        check_transfers(sess);
+        *running_transfers = (int) (sess->active_transfers + queued_requests(sess));
         return true;
     }
 
     // wait for something to happen
-    err = curl_multi_wait(multi_handle, NULL, 0, 1000, NULL);
+    err = curl_multi_poll(sess->multi_handle, NULL, 0, wait_timeout(sess), NULL);
     if (err) {
         fprintf(stderr, "FATAL %s:%s:%d: %s\n", __FILE__, __func__, __LINE__, curl_multi_strerror(err));
         return false;
     }
 
-    check_transfers(multi_handle);
+    check_transfers(sess);
+    *running_transfers = (int) (sess->active_transfers + queued_requests(sess));
     return true;
 }
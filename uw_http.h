@@ -1,5 +1,11 @@
 #pragma once
 
+#include <iconv.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/types.h>
+
 #include <curl/curl.h>
 #include <uw.h>
 
@@ -8,6 +14,11 @@ extern UwTypeId UwTypeId_HttpRequest;
  * type id for http request, returned by uw_subtype
  */
 
+extern UwTypeId UwTypeId_UrlBase;
+/*
+ * type id for pre-parsed base URL, see url_base_create
+ */
+
 extern int UwInterfaceId_Curl;
 /*
  * CURL interface id for HttpRequest
@@ -15,6 +26,194 @@ extern int UwInterfaceId_Curl;
  * important: stick to naming conventions for uw_get_interface macro to work
  */
 
+typedef struct {
+    _UwValue* items;  // ring buffer
+    unsigned head;
+    unsigned count;
+    unsigned capacity;
+} HttpValueQueue;
+
+typedef struct _HttpHost HttpHost;
+
+typedef struct {
+    char* name;
+    struct curl_slist* headers;  // built once and shared read-only by all requests
+} HttpHeaderProfile;
+
+#define HTTP_DEFAULT_HEADER_PROFILE  "tor-browser"
+#define HTTP_MAX_HEADER_PROFILES     16
+
+/*
+ * Bump allocator for short-lived per-request data.
+ * Memory is released all at once by http_arena_reset or http_arena_free.
+ */
+#define HTTP_ARENA_BLOCK_SIZE  4096
+
+typedef struct _HttpArenaBlock {
+    struct _HttpArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} HttpArenaBlock;
+
+typedef struct {
+    HttpArenaBlock* blocks;  // the most recent first
+} HttpArena;
+
+/*
+ * Response headers of all responses received by the transfer,
+ * including redirects and interim ones.
+ */
+#define HTTP_HEADER_INDEX_SIZE  64  // number of hash buckets, must be a power of two
+
+typedef struct _HttpResponseHeader {
+    struct _HttpResponseHeader* next;  // previous header with the same hash
+    uint32_t hash;
+    unsigned response;  // response number, starting from 1
+    unsigned name_len;
+    unsigned value_len;
+    char* name;         // case-folded, null-terminated
+    char* value;        // without leading and trailing whitespace, null-terminated
+} HttpResponseHeader;
+
+typedef struct {
+    HttpArena arena;
+    HttpResponseHeader* buckets[HTTP_HEADER_INDEX_SIZE];  // the latest header first
+    HttpResponseHeader* last;  // for continuation lines
+    unsigned num_responses;
+} HttpHeaderIndex;
+
+/*
+ * Results of header parsers, pointing either to the header value
+ * or to the arena if unescaping was necessary.
+ * Not null-terminated.
+ */
+typedef struct {
+    char* ptr;
+    unsigned length;
+} HttpSlice;
+
+typedef struct {
+    HttpSlice name;      // without trailing asterisk for ext-value
+    HttpSlice value;
+    HttpSlice charset;   // ext-value only
+    HttpSlice language;  // ext-value only
+    bool is_ext_value;
+} HttpHeaderParam;
+
+typedef struct {
+    bool valid;
+    HttpSlice type;
+    HttpSlice subtype;   // empty for Content-Disposition
+    HttpHeaderParam* params;
+    unsigned num_params;
+} HttpHeaderView;
+
+#define HTTP_CHUNK_BLOCK_SIZE      (64 * 1024)
+#define HTTP_CHUNK_POOL_MAX_BLOCKS  64  // per thread
+
+typedef struct _HttpChunkBlock HttpChunkBlock;
+struct _HttpChunkBlock {
+    HttpChunkBlock* next;
+    size_t used;
+    uint8_t data[HTTP_CHUNK_BLOCK_SIZE];
+};
+
+typedef struct {
+    HttpChunkBlock* first;
+    HttpChunkBlock* last;
+    size_t length;
+} HttpChunkChain;
+/*
+ * Segmented buffer made of fixed-size blocks.
+ * Blocks are taken from and returned to per-thread pool.
+ */
+
+typedef bool (*HttpSegmentVisitor)(uint8_t* data, size_t size, void* arg);
+
+typedef enum {
+    HTTP_SINK_MEMORY,  // req->content, or req->chunks if Content-Length is unknown
+    HTTP_SINK_FD,      // pwrite to file descriptor
+    HTTP_SINK_MMAP     // preallocated and mapped file, used instead of HTTP_SINK_FD when Content-Length is known
+} HttpSinkType;
+
+typedef struct {
+    HttpSinkType type;
+    bool opened;       // set on the first chunk of the body
+    bool own_fd;       // close fd when the sink is closed
+    bool preallocate;  // switch to HTTP_SINK_MMAP if Content-Length is known
+    bool discard;      // body of error response is not written to the file
+    int fd;
+    off_t offset;      // where the next chunk goes, starts from resume position
+
+    uint8_t* map;
+    size_t map_size;
+    off_t map_offset;  // file offset of map[0], page-aligned
+    off_t map_end;     // file offset of the end of preallocated space
+} HttpBodySink;
+
+typedef enum {
+    HTTP_ENCODING_IDENTITY,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_DEFLATE,
+    HTTP_ENCODING_BROTLI,
+    HTTP_ENCODING_ZSTD,
+    HTTP_ENCODING_UNKNOWN    // unsupported or multiple codings
+} HttpContentEncoding;
+
+#define HTTP_DECODER_BUFFER_SIZE  16384  // decoded data is passed to output in pieces of this size
+
+typedef struct {
+    HttpContentEncoding encoding;
+    void* state;       // z_stream, BrotliDecoderState, or ZSTD_DStream
+    bool raw_deflate;  // deflate without zlib wrapper, as some servers send it
+    bool finished;     // the end of compressed stream is reached
+} HttpDecoder;
+/*
+ * Streaming decoder of raw content.
+ */
+
+typedef enum {
+    HTTP_CHARSET_PASS,          // UTF-8 or unknown charset, the body is written as is
+    HTTP_CHARSET_ASCII_RUNS,    // multibyte sequences never contain ASCII bytes, runs of them are copied
+    HTTP_CHARSET_ASCII_PREFIX,  // ASCII bytes can trail multibyte sequences, only leading ASCII of a chunk is copied
+    HTTP_CHARSET_CONVERT        // not ASCII-compatible, everything goes through iconv
+} HttpCharsetMode;
+
+#define HTTP_CHARSET_MAX_NAME   40   // longer charset names are ignored
+#define HTTP_CHARSET_SNIFF_SIZE 1024 // meta charset is looked up within this many bytes of HTML
+#define HTTP_CHARSET_MIN_ASCII_RUN  32  // shorter ASCII runs are converted along with the text around
+
+typedef struct {
+    bool started;         // charset is chosen when enough of the body is received for sniffing
+    HttpCharsetMode mode;
+    iconv_t cd;           // open if started and mode is not pass
+    unsigned carry_len;
+    uint8_t carry[16];    // incomplete sequence at the end of the previous chunk
+    unsigned head_len;
+    uint8_t head[HTTP_CHARSET_SNIFF_SIZE];  // beginning of the body while not started
+} HttpCharsetDecoder;
+/*
+ * Conversion of text body to UTF-8 while receiving.
+ */
+
+typedef struct {
+    // times since the start of transfer, in microseconds, see CURLINFO_*_TIME_T
+    curl_off_t namelookup;
+    curl_off_t connect;
+    curl_off_t appconnect;
+    curl_off_t pretransfer;
+    curl_off_t starttransfer;
+    curl_off_t total;
+    curl_off_t redirect;
+
+    curl_off_t size_download;
+    curl_off_t size_upload;
+    long header_size;
+    long request_size;
+    long redirect_count;
+} HttpRequestTiming;
+
 typedef size_t (*HttpRequestWriter)  (void* data, size_t always_1, size_t size, UwValuePtr self);
 typedef void   (*HttpRequestComplete)(UwValuePtr self);
 
@@ -25,59 +224,1056 @@ typedef struct {
 } UwInterface_Curl;
 
 
+// flags for parsed_headers
+#define HTTP_PARSED_CONTENT_TYPE_VIEW  1
+#define HTTP_PARSED_CONTENT_TYPE       2
+#define HTTP_PARSED_DISPOSITION_VIEW   4
+#define HTTP_PARSED_DISPOSITION        8
+
 typedef struct {
     _UwExtraData value_data;
 
+    // Acquired from the session's handle pool by add_http_request
+    // and returned to the pool when the transfer is finished,
+    // i.e. it is valid only until `complete` method returns.
     CURL* easy_handle;
 
     _UwValue url;
     _UwValue proxy;
+    _UwValue cookie;
     _UwValue real_url;
 
-    // Parsed headers, call http_request_parse_headers for that.
-    // Can be nullptr!
+    size_t resume_pos;
+
+    // Parsed headers, filled on first call of http_request_media_type
+    // and other accessors, or on completion if http_request_set_parse_headers is set.
+    // Until then media_type and media_subtype are empty strings,
+    // media_type_params is an empty map, and disposition fields are null.
+    // Disposition fields stay null if there's no Content-Disposition header.
     _UwValue media_type;
     _UwValue media_subtype;
     _UwValue media_type_params;  // map
     _UwValue disposition_type;
     _UwValue disposition_params; // values can be strings of maps containing charset, language, and value
 
+    // Where the body goes, req->content by default.
+    HttpBodySink sink;
+
     // The content received by default handlers.
-    // Always binary, regardless of content-type charset
+    // Binary, regardless of content-type charset, unless decode_charset is set
     _UwValue content;
 
+    // The content of unknown length is received in chunks and flattened
+    // to req->content when the transfer is finished, unless segmented_content is set.
+    HttpChunkChain chunks;
+    bool segmented_content;
+
+    // Convert text to UTF-8 while receiving, see http_request_set_decode_charset.
+    bool decode_charset;
+    bool content_is_utf8;  // set when the body was converted or declared as UTF-8
+    bool charset_unsupported;  // set when iconv does not know the charset, the body is kept as is
+    HttpCharsetDecoder charset_decoder;
+
+    // Keep the body as received, without decoding, see http_request_set_raw_content.
+    bool raw_content;
+    HttpContentEncoding content_encoding;  // of raw content, set when the transfer is finished
+
+    // Request headers are sent from the profile,
+    // the session's profile is used if nullptr.
+    HttpHeaderProfile* header_profile;
+
+    // Per-request headers added on top of the profile.
+    struct curl_slist* extra_headers;
+
+    // Merged list of extra, conditional, and profile headers.
+    // Allocated by add_http_request only if extra or conditional headers are not empty.
     struct curl_slist* headers;
+    unsigned num_headers;
+
+    // Disk cache state, set by http_disk_cache_prepare when the transfer starts.
+    struct curl_slist* conditional_headers;  // If-None-Match and If-Modified-Since
+    uint64_t cache_key;     // fingerprint of canonical URL
+    uint64_t cache_offset;  // of cached response in the log
+    uint64_t cache_size;    // zero if the response is not cached
+    bool cache_store;       // the response can be stored, the body is collected in chunks
+    bool from_cache;        // content was filled from the disk cache after 304, or from the memory cache
+
+    // Response headers captured while receiving.
+    HttpHeaderIndex response_headers;
+
+    // Parsed headers, allocated in the arena of response_headers.
+    HttpHeaderView content_type_view;
+    HttpHeaderView disposition_view;
+    unsigned parsed_headers;  // HTTP_PARSED_* flags
+    bool parse_headers_on_complete;  // see http_request_set_parse_headers
 
     unsigned int status;
+    CURLcode result;  // set when transfer is finished
+
+    // Set by session if per-host limits are enabled, owned by the session.
+    HttpHost* host;
+    HttpRequestTiming timing;
 
 } HttpRequestData;
 
+typedef struct {
+    _UwExtraData value_data;
+
+    CURLU* handle;  // parsed base URL, duplicated for references that need full resolution
+    char*  url;     // normalized base URL, allocated by CURL
+    size_t scheme_length;   // without colon
+    size_t origin_length;   // scheme and authority, zero if URL has no authority
+    size_t fragment_start;  // position of '#' or length of URL
+    bool   is_http;         // http or https, fast paths are enabled
+} UrlBaseData;
+
+/*
+ * Open addressing table of 64-bit URL fingerprints.
+ * The same layout is used for the file when the table is mapped.
+ */
+#define HTTP_SEEN_SET_MAGIC         0x31544553574155ULL  // "UAWSET1"
+#define HTTP_SEEN_SET_MAX_CAPACITY  (1ULL << 59)         // table size in bytes must fit size_t
+
+typedef struct {
+    uint64_t magic;
+    uint64_t capacity;  // power of two
+    uint64_t count;
+    uint64_t slots[];   // zero means empty
+} HttpSeenTable;
+
+typedef struct {
+    HttpSeenTable* table;
+    size_t size;  // of table in bytes
+    int fd;       // -1 if the table is in memory
+    char* path;   // of mapped table, the grown table is written to path.tmp and renamed over it
+} HttpSeenSet;
+
+typedef struct {
+    CURL**   handles;   // idle easy handles, pre-configured with default options
+    unsigned count;
+    unsigned max_size;
+    uint64_t hits;      // number of handles taken from the pool
+    uint64_t misses;    // number of handles created because the pool was empty
+} HttpHandlePool;
+
+#define HTTP_DEFAULT_HANDLE_POOL_SIZE  64
+
+typedef enum {
+    HTTP_ENGINE_POLL,   // curl_multi_perform and curl_multi_poll on all transfers
+    HTTP_ENGINE_EPOLL   // curl_multi_socket_action on ready sockets only, driven by epoll and timerfd
+} HttpSessionEngine;
+
+#define HTTP_EPOLL_MAX_EVENTS  256
+
+typedef enum {
+    HTTP_LOG_OFF,
+    HTTP_LOG_ERROR,  // failed transfers
+    HTTP_LOG_INFO    // all finished transfers
+} HttpLogLevel;
+
+#define HTTP_LOG_URL_SIZE         256  // longer URLs are truncated
+#define HTTP_LOG_RING_SIZE        256  // must be a power of two
+#define HTTP_LOG_DRAIN_INTERVAL   100  // milliseconds, for log thread
+
+typedef struct {
+    HttpLogLevel level;
+    unsigned status;
+    CURLcode result;
+    curl_off_t total_time;  // microseconds
+    char url[HTTP_LOG_URL_SIZE];  // effective URL
+} HttpLogEvent;
+
+typedef struct {
+    _Atomic uint64_t head;     // next event to write
+    _Atomic uint64_t tail;     // next event to read
+    _Atomic uint64_t dropped;  // events dropped because the ring was full
+    HttpLogEvent events[HTTP_LOG_RING_SIZE];
+} HttpLogRing;
+/*
+ * Single producer, single consumer lock-free ring buffer.
+ */
+
+typedef void (*HttpLogHandler)(HttpLogEvent* event, void* arg);
+
+typedef struct {
+    HttpSessionEngine engine;       // can't be changed after session is created
+    HttpLogLevel log_level;
+    FILE* log_file;                 // if set, e.g. to stderr, the log thread prints events there;
+                                    // nullptr by default: drain the log with http_log_ring_drain
+                                    // or set log_level to HTTP_LOG_OFF, unread events are dropped
+                                    // when the ring is full
+    bool collect_finished;          // keep finished requests for http_session_drain
+    unsigned max_active_transfers;  // the rest of requests wait in priority queue, 0 means no limit
+
+    // per-host limits, the rest of requests for the host are deferred
+    double   host_rate;             // requests per second, 0 means no limit
+    unsigned host_burst;            // max requests started at once when rate is limited, token bucket size
+    unsigned max_host_transfers;    // active transfers per host, 0 means no limit
+
+    long max_total_connections;     // CURLMOPT_MAX_TOTAL_CONNECTIONS, 0 means no limit
+    long max_host_connections;      // CURLMOPT_MAX_HOST_CONNECTIONS, 0 means no limit
+    long max_concurrent_streams;    // CURLMOPT_MAX_CONCURRENT_STREAMS, per HTTP/2 connection
+    long max_connects;              // CURLMOPT_MAXCONNECTS, connection cache size, 0 means CURL default
+
+    long timeout;                   // CURLOPT_TIMEOUT for requests, in seconds
+    long connect_timeout;           // CURLOPT_CONNECTTIMEOUT, in seconds
+    bool verbose;                   // CURLOPT_VERBOSE
+    long http_version;              // CURLOPT_HTTP_VERSION, 0 means CURL default
+
+    unsigned handle_pool_size;
+} HttpSessionConfig;
+
+// new connection to a host name with name lookup faster than that
+// is considered to be served from DNS cache, in microseconds
+#define HTTP_DNS_CACHE_HIT_TIME  100
+
+typedef struct {
+    CURLSH* share;
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+
+    _Atomic uint64_t transfers;
+    _Atomic uint64_t new_connections;
+    _Atomic uint64_t reused_connections;
+    _Atomic uint64_t dns_cache_hits;
+    _Atomic uint64_t tls_handshakes;
+} HttpSharedCache;
+/*
+ * DNS, TLS session, and, optionally, connection cache
+ * shared by sessions via curl_share.
+ */
+
+typedef struct {
+    uint64_t transfers;           // finished transfers of attached sessions
+    uint64_t new_connections;     // transfers that opened at least one connection
+    uint64_t reused_connections;  // transfers over kept-alive connections, shared or not
+    uint64_t dns_cache_hits;      // new connections to host names resolved from DNS cache
+    uint64_t tls_handshakes;      // new HTTPS connections, full or resumed
+} HttpSharedCacheStats;
+/*
+ * Counters of attached sessions. CURL does not tell which cache hit came
+ * from the share rather than the session's own caches, so what the share
+ * saved is the difference against a run without it.
+ * IP-literal URLs are not counted as DNS cache hits.
+ */
+
+/*
+ * Latency histogram with fixed memory footprint, HDR-style:
+ * each power of two range is divided into HTTP_HISTOGRAM_SUB_BUCKETS linear buckets,
+ * so values are recorded with ~3% precision.
+ * Values are microseconds, those exceeding 2^40 are counted in the last bucket.
+ */
+#define HTTP_HISTOGRAM_SUB_BITS     5
+#define HTTP_HISTOGRAM_SUB_BUCKETS  (1 << HTTP_HISTOGRAM_SUB_BITS)
+#define HTTP_HISTOGRAM_BUCKETS      (HTTP_HISTOGRAM_SUB_BUCKETS * (40 - HTTP_HISTOGRAM_SUB_BITS + 1))
+
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[HTTP_HISTOGRAM_BUCKETS];
+} HttpLatencyHistogram;
+
+typedef enum {
+    HTTP_PHASE_DNS,       // name lookup
+    HTTP_PHASE_CONNECT,   // TCP connect
+    HTTP_PHASE_TLS,       // TLS handshake, recorded for TLS connections only
+    HTTP_PHASE_TTFB,      // from sending request to the first byte of response
+    HTTP_PHASE_TRANSFER,  // receiving response
+    HTTP_PHASE_TOTAL,
+    HTTP_NUM_PHASES
+} HttpLatencyPhase;
+
+#define HTTP_PRIORITY_LOW     -10
+#define HTTP_PRIORITY_NORMAL    0
+#define HTTP_PRIORITY_HIGH     10
+
+typedef struct {
+    int priority;
+    uint64_t seq;  // to keep FIFO order within the same priority
+    _UwValue request;
+} HttpPendingRequest;
+
+typedef struct {
+    HttpPendingRequest* items;  // binary heap
+    unsigned count;
+    unsigned capacity;
+    uint64_t next_seq;
+} HttpPendingQueue;
+
+typedef enum {
+    HTTP_HOST_IDLE,        // no deferred requests
+    HTTP_HOST_WAIT_TIMER,  // in timer wheel, waiting for token
+    HTTP_HOST_WAIT_SLOT,   // waiting for active transfers to finish
+    HTTP_HOST_READY        // in the list of ready hosts
+} HttpHostState;
+
+struct _HttpHost {
+    HttpHost* next;               // in timer wheel slot or in the list of ready hosts
+    HttpHostState state;
+    double tokens;
+    uint64_t refill_time;         // CLOCK_MONOTONIC, microseconds
+    uint64_t due_time;            // when the host leaves timer wheel
+    unsigned active_transfers;
+    HttpValueQueue deferred;
+    uint64_t hash;
+    char origin[];                // scheme://host:port
+};
+
+#define HTTP_HOST_WHEEL_SLOTS  256  // must be a power of two
+#define HTTP_HOST_WHEEL_TICK    10  // milliseconds
+
+typedef struct {
+    HttpHost** table;             // open addressing hash table
+    unsigned capacity;
+    unsigned count;
+    unsigned deferred;            // total number of deferred requests
+
+    HttpHost* ready_head;         // hosts with deferred requests that can be started
+    HttpHost* ready_tail;
+
+    HttpHost* wheel[HTTP_HOST_WHEEL_SLOTS];
+    uint64_t wheel_tick;          // last processed tick
+    unsigned wheel_count;
+} HttpHostScheduler;
+/*
+ * Per-host token buckets and active transfer counters.
+ * Hosts that ran out of tokens are woken up by timer wheel,
+ * so requests of other hosts are not blocked and deferred ones are not re-checked on each pass.
+ */
+
+/*
+ * Disk cache: responses are appended to the log file,
+ * the index file maps URL fingerprints to the latest record of the URL
+ * and keeps validators, so that lookups never read the log.
+ * Both live in one directory and persist across runs.
+ * Records are written and synced by the writer thread before the index points to them.
+ * Not thread-safe otherwise, a cache must not be used by more than one session at once.
+ */
+#define HTTP_DISK_CACHE_MAGIC             0x32584449574155ULL  // "UAWIDX2"
+#define HTTP_CACHE_RECORD_MAGIC           0x32434552u          // "REC2"
+#define HTTP_DISK_CACHE_INITIAL_CAPACITY  4096   // index entries, power of two
+#define HTTP_CACHE_MAX_FIELD_SIZE         4096   // longer header values are not cached
+#define HTTP_CACHE_MAX_ETAG               72     // longer ETag is not used for revalidation
+#define HTTP_CACHE_MAX_LAST_MODIFIED      32     // IMF-fixdate is 29 characters
+
+typedef struct {
+    uint64_t key;     // URL fingerprint, zero means empty
+    uint64_t offset;  // of record in the log
+    uint64_t size;    // of record
+    // null-terminated validators, empty if missing
+    char last_modified[HTTP_CACHE_MAX_LAST_MODIFIED];
+    char etag[HTTP_CACHE_MAX_ETAG];
+} HttpCacheEntry;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t capacity;
+    uint64_t count;
+    HttpCacheEntry entries[];
+} HttpCacheIndex;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t status;
+    uint64_t fingerprint;
+    int64_t  stored_time;
+    uint64_t body_length;
+    // lengths of null-terminated header values, zero if missing
+    uint16_t etag_length;
+    uint16_t last_modified_length;
+    uint16_t content_type_length;
+    uint16_t disposition_length;
+    uint32_t checksum;  // CRC-32 of header values and body
+    uint32_t reserved;
+} HttpCacheRecord;
+/*
+ * Record in the log, followed by header values and the body.
+ */
+
+typedef struct _HttpCacheJob {
+    struct _HttpCacheJob* next;
+    HttpCacheEntry entry;  // key and validators, the writer sets offset and size
+    HttpChunkChain body;   // copy of the body
+    size_t header_size;
+    uint8_t header[];      // record and header values
+} HttpCacheJob;
+
+typedef struct {
+    HttpCacheIndex* index;  // mapped index file, guarded by lock
+    size_t index_size;
+    int index_fd;
+    int log_fd;
+    off_t log_end;          // owned by the writer thread
+
+    // read-only mapping of the log, used by the session thread to fill 304 responses
+    uint8_t* log_map;
+    size_t log_map_size;
+
+    pthread_t writer;
+    bool writer_started;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    HttpCacheJob* jobs_head;
+    HttpCacheJob* jobs_tail;
+
+    uint64_t misses;
+    uint64_t revalidated;   // 304 responses filled from the cache
+    uint64_t stored;        // updated by the writer thread under lock
+} HttpDiskCache;
+
+/*
+ * Memory cache: fresh responses kept by URL fingerprint within a byte budget,
+ * least recently used ones are evicted first.
+ * Entries share the content with requests, so the content of finished requests
+ * must not be modified in place.
+ * Not thread-safe, like the disk cache.
+ */
+#define HTTP_MEMORY_CACHE_INITIAL_BUCKETS  256  // power of two
+
+typedef struct _HttpMemoryCacheEntry HttpMemoryCacheEntry;
+struct _HttpMemoryCacheEntry {
+    HttpMemoryCacheEntry* next;      // in hash bucket
+    HttpMemoryCacheEntry* lru_prev;  // more recently used
+    HttpMemoryCacheEntry* lru_next;  // less recently used
+    uint64_t key;                    // URL fingerprint
+    HttpHeaderProfile* profile;      // request headers the response was fetched with
+    uint64_t expires;                // CLOCK_MONOTONIC, microseconds
+    size_t size;                     // charged against the budget
+    size_t alloc_size;               // of this structure with headers
+    _UwValue content;
+    unsigned disposition_offset;     // in headers, zero if missing
+    char headers[];                  // null-terminated Content-Type and Content-Disposition values
+};
+
+typedef struct {
+    HttpMemoryCacheEntry** buckets;
+    unsigned capacity;
+    unsigned count;
+    HttpMemoryCacheEntry* lru_head;  // the most recently used
+    HttpMemoryCacheEntry* lru_tail;
+    size_t budget;                   // bytes
+    size_t used;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stored;
+    uint64_t evicted;
+} HttpMemoryCache;
+
+typedef void (*HttpSessionDone)(void* session, UwValuePtr request, void* arg);
+/*
+ * Called by the session for each finished request, including failed ones,
+ * after `complete` method.
+ * The request is destroyed by the session after the call.
+ * To keep it, the callback should take it with uw_move rather than clone,
+ * so that the reference count is never changed from two threads.
+ * Taken requests are not added to the queue of finished requests.
+ */
+
+typedef struct {
+    CURLM* multi_handle;
+    HttpSessionConfig config;
+    HttpSharedCache* shared_cache;
+    HttpDiskCache* disk_cache;
+    HttpMemoryCache* memory_cache;
+
+    HttpSessionDone on_done;
+    void* on_done_arg;
+
+    // finished requests, if collect_finished is set in config
+    HttpValueQueue finished;
+
+    // latencies of successful transfers
+    HttpLatencyHistogram latency[HTTP_NUM_PHASES];
+
+    // event log, allocated if log level is not HTTP_LOG_OFF
+    HttpLogRing* log_ring;
+    FILE* log_file;
+    pthread_t log_thread;
+    bool log_thread_started;
+    _Atomic bool log_thread_stop;
+    HttpHandlePool handle_pool;
+    HttpHeaderProfile* header_profile;
+
+    unsigned active_transfers;  // added to multi handle and not finished yet
+    HttpPendingQueue pending;   // waiting for admission
+    HttpHostScheduler hosts;    // requests deferred by per-host limits
+    HttpValueQueue cache_hits;  // served from the memory cache, finished by the next http_perform
+
+    // epoll engine
+    int epoll_fd;
+    int timer_fd;
+    int wakeup_fd;
+    int still_running;
+} HttpSession;
+
+#define HTTP_RUNNER_BATCH_SIZE  32  // max requests a worker takes from the queue at once
+
+typedef struct {
+    unsigned num_workers;
+    unsigned max_transfers_per_worker;
+    HttpSessionConfig session_config;  // for each worker session, log_file starts a log thread per worker
+    HttpSharedCache* shared_cache;     // optional, attached to worker sessions
+} HttpRunnerConfig;
+
+typedef struct _HttpCompletion HttpCompletion;
+struct _HttpCompletion {
+    HttpCompletion* next;
+    _UwValue request;
+};
+
+typedef struct _HttpRunner HttpRunner;
+
+typedef struct {
+    HttpRunner* runner;
+    unsigned index;
+    void* session;
+    pthread_t thread;
+    bool started;
+} HttpRunnerWorker;
+
+struct _HttpRunner {
+    HttpRunnerConfig config;
+    HttpRunnerWorker* workers;
+    unsigned num_workers;  // started workers
+
+    // submission queue, workers take requests from it when they have room for new transfers
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    HttpValueQueue queue;
+    unsigned idle_workers;
+    unsigned next_wakeup;
+    bool stop;
+
+    // completion queue: workers push to lock-free stack,
+    // the caller takes it whole and keeps in drained list
+    _Atomic(HttpCompletion*) completed;
+    HttpCompletion* drained;
+    int completion_fd;  // eventfd, readable when there are completions
+
+    _Atomic unsigned pending;  // submitted and not drained yet
+};
+
 // global initialization
 void init_http();
 void cleanup_http();
 
+// header profiles
+bool http_register_header_profile(char* name, char** headers, unsigned num_headers);
+/*
+ * Build header list and register it under the given name.
+ * Profiles can't be modified and should be registered before creating sessions.
+ */
+
+HttpHeaderProfile* http_get_header_profile(char* name);
+/*
+ * Return profile by name or nullptr.
+ */
+
 // sessions
 void* create_http_session();
+void* create_http_session_with_engine(HttpSessionEngine engine);
+void* create_http_session_with_config(HttpSessionConfig* config);
 bool add_http_request(void* session, UwValuePtr request);
+bool add_http_request_with_priority(void* session, UwValuePtr request, int priority);
+/*
+ * If max_active_transfers limit is reached, the request waits in priority queue
+ * and is started when other transfers are finished.
+ * Requests with higher priority are started first.
+ * Requests that fail to start later on are reported as finished with CURLE_FAILED_INIT.
+ */
 void delete_http_session(void* session);
 
+void http_session_default_config(HttpSessionConfig* config);
+
+bool http_session_configure(void* session, HttpSessionConfig* config);
+/*
+ * Apply new configuration to the session, except engine.
+ * Request options take effect for subsequently added requests.
+ */
+
+void http_session_get_config(void* session, HttpSessionConfig* config);
+
+void http_session_set_handle_pool_size(void* session, unsigned max_size);
+/*
+ * Set maximal number of idle easy handles kept by the session.
+ * Excessive handles are destroyed immediately.
+ */
+
+bool http_session_set_header_profile(void* session, char* profile_name);
+
+void http_session_attach_shared_cache(void* session, HttpSharedCache* cache);
+/*
+ * Attach shared cache to the session, or detach if cache is nullptr.
+ * Takes effect for idle handles and subsequently added requests,
+ * detach only when the session has no active transfers.
+ */
+
+// shared cache
+HttpSharedCache* http_create_shared_cache(bool share_connections);
+/*
+ * Connection cache sharing is not thread-safe in CURL,
+ * don't enable it for sessions running in different threads.
+ */
+bool http_delete_shared_cache(HttpSharedCache* cache);
+/*
+ * Return false and keep the cache intact if it is still in use,
+ * i.e. some sessions are not detached or deleted yet.
+ */
+void http_shared_cache_update_stats(HttpSharedCache* cache, CURL* easy_handle);
+void http_shared_cache_get_stats(HttpSharedCache* cache, HttpSharedCacheStats* stats);
+
+unsigned http_session_drain(void* session, UwValuePtr out_list, unsigned max);
+/*
+ * Move up to max finished requests, including failed ones, to out_list.
+ * Return the number of moved requests.
+ * Requests are collected only if collect_finished is set in session config.
+ * Check req->result for CURL error code.
+ */
+
+void http_session_set_done_callback(void* session, HttpSessionDone callback, void* arg);
+
+void http_session_wakeup(void* session);
+/*
+ * Interrupt waiting in http_perform. Can be called from any thread.
+ */
+
+// disk cache
+HttpDiskCache* http_create_disk_cache(char* directory);
+void http_delete_disk_cache(HttpDiskCache* cache);
+/*
+ * Wait for pending writes and close the cache.
+ */
+void http_session_set_disk_cache(void* session, HttpDiskCache* cache);
+/*
+ * Store successful responses that have ETag or Last-Modified,
+ * make repeat requests conditional and fill content of 304 responses from the cache.
+ * Only requests with memory sink are cached.
+ */
+bool http_disk_cache_prepare(HttpDiskCache* cache, HttpRequestData* req);
+/*
+ * Called when the transfer starts. Reset cache state of the request and,
+ * if cache is not nullptr and the URL is cached, make conditional headers.
+ * Return false if out of memory.
+ */
+void http_disk_cache_complete(HttpDiskCache* cache, HttpRequestData* req);
+/*
+ * Called when the transfer is finished, before chunks are flattened.
+ * Fill 304 response from the cache or queue 200 response for the writer thread.
+ */
+
+// memory cache
+HttpMemoryCache* http_create_memory_cache(size_t budget);
+void http_delete_memory_cache(HttpMemoryCache* cache);
+void http_session_set_memory_cache(void* session, HttpMemoryCache* cache);
+/*
+ * Keep 200 responses with Cache-Control max-age and valid Content-Type
+ * until they expire or are evicted. Requests for fresh URLs never reach CURL,
+ * add_http_request queues them and the next http_perform finishes them.
+ * Only requests with memory sink, without cookie and extra headers are cached,
+ * and responses are keyed by URL and header profile.
+ * Responses with Vary other than Accept-Encoding are not cached.
+ */
+bool http_memory_cache_lookup(HttpMemoryCache* cache, HttpRequestData* req, HttpHeaderProfile* profile);
+/*
+ * Fill the request from the cache and return true if a fresh response is there.
+ * Profile is the one the request would be sent with.
+ */
+void http_memory_cache_store(HttpMemoryCache* cache, HttpRequestData* req, HttpHeaderProfile* profile);
+/*
+ * Called when the transfer is finished, after chunks are flattened.
+ */
+
+// statistics
+void http_request_update_timing(HttpRequestData* req);
+void http_session_record_timing(void* session, HttpRequestData* req);
+/*
+ * Called by the session for finished requests.
+ */
+
+void http_session_latency_snapshot(void* session, HttpLatencyHistogram snapshot[HTTP_NUM_PHASES]);
+/*
+ * Copy session histograms. Can be called from any thread while the session is running.
+ */
+
+void     http_histogram_record(HttpLatencyHistogram* hist, uint64_t value);
+void     http_histogram_snapshot(HttpLatencyHistogram* hist, HttpLatencyHistogram* snapshot);
+void     http_histogram_reset(HttpLatencyHistogram* hist);
+uint64_t http_histogram_percentile(HttpLatencyHistogram* hist, double percentile);
+
+// event log
+HttpLogRing* http_create_log_ring();
+void http_delete_log_ring(HttpLogRing* ring);
+void http_log_event(HttpLogRing* ring, HttpLogLevel level, HttpRequestData* req);
+
+unsigned http_log_ring_drain(HttpLogRing* ring, HttpLogHandler handler, void* arg, unsigned max);
+/*
+ * Pass up to max events to handler, return the number of processed events.
+ * Must be called from one thread only, e.g. after http_perform or by the log thread.
+ */
+
+void http_log_print_event(HttpLogEvent* event, void* file);
+/*
+ * Log handler that prints event to FILE* passed as arg.
+ */
+
+bool http_session_start_log_thread(void* session, FILE* file);
+void http_session_stop_log_thread(void* session);
+/*
+ * Background thread that drains session log to the file.
+ * Same as setting log_file in session config, which is updated accordingly.
+ */
+
+// priority queue
+bool     http_pending_push(HttpPendingQueue* queue, UwValuePtr request, int priority);  // moves request
+UwResult http_pending_pop(HttpPendingQueue* queue);  // return null if queue is empty
+void     http_pending_fini(HttpPendingQueue* queue);
+
+// per-host scheduler
+HttpHost* http_host_lookup(HttpHostScheduler* hosts, char* url);
+/*
+ * Find or create host for the origin of URL.
+ * Return nullptr if URL is malformed or out of memory.
+ */
+bool http_host_admit(HttpHost* host, HttpSessionConfig* config);
+/*
+ * Return true if a new request for the host can be started right now,
+ * i.e. the host has no deferred requests and is within limits.
+ */
+bool http_host_defer(HttpHostScheduler* hosts, HttpHost* host, UwValuePtr request, HttpSessionConfig* config);
+/*
+ * Append request to the host queue, moving it.
+ */
+UwResult http_host_take_ready(HttpHostScheduler* hosts, HttpSessionConfig* config);
+/*
+ * Take deferred request that can be started right now.
+ * Return null if there's none.
+ */
+void http_host_started(HttpHost* host, HttpSessionConfig* config);
+void http_host_finished(HttpHostScheduler* hosts, HttpHost* host, HttpSessionConfig* config);
+void http_host_advance_wheel(HttpHostScheduler* hosts, HttpSessionConfig* config);
+int  http_host_wheel_timeout(HttpHostScheduler* hosts);
+/*
+ * Return milliseconds until the next host leaves timer wheel, -1 if the wheel is empty.
+ */
+void http_host_scheduler_fini(HttpHostScheduler* hosts);
+
+// value queue
+bool     http_value_queue_push(HttpValueQueue* queue, UwValuePtr value);  // moves value
+UwResult http_value_queue_pop(HttpValueQueue* queue);  // return null if queue is empty
+void     http_value_queue_fini(HttpValueQueue* queue);
+
+// multi-threaded runner
+void http_runner_default_config(HttpRunnerConfig* config);
+HttpRunner* http_create_runner(HttpRunnerConfig* config);
+void http_delete_runner(HttpRunner* runner);
+
+bool http_runner_submit(HttpRunner* runner, UwValuePtr request);
+/*
+ * Move request to the submission queue.
+ * The request must not be accessed until it is returned by http_runner_drain.
+ */
+
+unsigned http_runner_drain(HttpRunner* runner, UwValuePtr out_list, unsigned max);
+/*
+ * Append up to max finished requests to out_list, return the number of appended requests.
+ * Check req->result for CURL error code.
+ * Must be called from one thread only.
+ */
+
+unsigned http_runner_pending(HttpRunner* runner);
+/*
+ * Return the number of submitted requests not drained yet.
+ */
+
+int http_runner_completion_fd(HttpRunner* runner);
+/*
+ * Return file descriptor that becomes readable when finished requests are available.
+ */
+
 // request
 void http_request_set_url(UwValuePtr request, UwValuePtr url);
 void http_request_set_proxy(UwValuePtr request, UwValuePtr proxy);
 void http_request_set_cookie(UwValuePtr request, UwValuePtr cookie);
 void http_request_set_resume(UwValuePtr request, size_t pos);
+bool http_request_set_header_profile(UwValuePtr request, char* profile_name);
+
+void http_request_set_parse_headers(UwValuePtr request, bool on_complete);
+/*
+ * Fill media_type, disposition_type and other parsed header fields
+ * in the default `complete` method, as it was before they were parsed on demand.
+ * For code that reads the fields directly instead of using accessors.
+ */
+
+bool http_request_add_header(UwValuePtr request, char* header);
+/*
+ * Add header on top of the profile.
+ * If the profile contains a header with the same name, it is not sent.
+ */
 
 void http_update_status(UwValuePtr request);
 
+// body sinks
+bool http_request_set_sink_fd(UwValuePtr request, int fd, bool preallocate);
+/*
+ * Write body to a regular file instead of req->content.
+ * The body of 206 response is written at resume position, see http_request_set_resume,
+ * the body of other 2xx responses is written from the start,
+ * and the file is truncated at the end of the body.
+ * The body of non-2xx responses is discarded and the file is left as is.
+ * If preallocate is true and Content-Length is known, the space for
+ * the body is allocated with posix_fallocate and written via mmap.
+ * The caller owns fd.
+ */
+
+bool http_request_set_sink_file(UwValuePtr request, char* path);
+/*
+ * Open or create a file and write body to it, with preallocation.
+ * Existing data is kept up to resume position.
+ */
+
+void http_request_set_segmented_content(UwValuePtr request, bool segmented);
+/*
+ * Leave the content of unknown length in req->chunks.
+ */
+
+void http_request_set_raw_content(UwValuePtr request, bool raw);
+/*
+ * Do not decode the body, keep Content-Encoding as received.
+ * With memory sink, raw content is left in req->chunks, use http_request_flatten_content
+ * to get it as is, or http_request_decode_content to decode it.
+ * Raw content is never cached.
+ */
+
+void http_request_set_decode_charset(UwValuePtr request, bool decode);
+/*
+ * Convert the body to UTF-8 on the fly, before it reaches the sink.
+ * The charset is taken from Content-Type, or sniffed from BOM
+ * or HTML meta tag in the first chunk. If it's unknown, the body is kept as is.
+ * Check req->content_is_utf8 when the transfer is finished,
+ * and req->charset_unsupported to tell unsupported charset from unknown one.
+ * Ignored for raw content; converted responses are not cached.
+ */
+
+UwResult http_request_flatten_content(HttpRequestData* req);
+/*
+ * Move the content from req->chunks to req->content, if not done yet,
+ * and return a clone of req->content.
+ */
+
+bool http_chunk_chain_append(HttpChunkChain* chain, uint8_t* data, size_t size);
+void http_chunk_chain_free(HttpChunkChain* chain);
+bool http_chunk_chain_foreach(HttpChunkChain* chain, HttpSegmentVisitor visitor, void* arg);
+/*
+ * Call visitor for each segment, stop if it returns false.
+ */
+UwResult http_chunk_chain_flatten(HttpChunkChain* chain);
+/*
+ * Make a binary string of chain content and free the chain.
+ */
+void http_chunk_pool_trim();
+/*
+ * Free pooled blocks of the calling thread.
+ */
+
+size_t http_charset_write(HttpRequestData* req, uint8_t* data, size_t size);
+/*
+ * Convert and pass data to http_sink_write.
+ * The charset is chosen on the first call.
+ */
+void   http_charset_close(HttpRequestData* req, bool success);
+/*
+ * Called by http_sink_close. On success, write replacement character
+ * for incomplete sequence left at the end of the body, if any.
+ */
+
+bool   http_sink_open(HttpRequestData* req);
+size_t http_sink_write(HttpRequestData* req, uint8_t* data, size_t size);
+void   http_sink_close(HttpRequestData* req, bool success);
+/*
+ * Sink primitives for write_data implementations.
+ * http_sink_open should be called on the first chunk, when headers are received.
+ * Sinks are closed by the session when transfer is finished.
+ */
+
 // runner
 bool http_perform(void* session, int* running_transfers);
+/*
+ * running_transfers includes pending requests.
+ */
+
+// content decoding
+HttpContentEncoding http_parse_content_encoding(char* header);
+/*
+ * Return encoding for Content-Encoding header value, identity if header is nullptr.
+ */
+bool http_decoder_init(HttpDecoder* decoder, HttpContentEncoding encoding);
+/*
+ * Return false if encoding is not supported or out of memory.
+ * Brotli and zstd are supported only if built with -DHTTP_WITH_BROTLI (link -lbrotlidec)
+ * and -DHTTP_WITH_ZSTD (link -lzstd).
+ */
+bool http_decoder_write(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg);
+/*
+ * Decode next piece of input and pass decoded data to output.
+ * Return false if input is malformed or output returns false.
+ * Check `finished` field after the last piece to make sure the input was complete.
+ */
+void http_decoder_fini(HttpDecoder* decoder);
+
+UwResult http_request_decode_content(HttpRequestData* req);
+/*
+ * Decode raw content left in req->chunks, the chunks are kept.
+ * Return flattened content if it is not encoded,
+ * null if it's malformed, truncated, or flattened already.
+ */
+
+// arena
+void* http_arena_alloc(HttpArena* arena, size_t size);  // 8-byte aligned
+void  http_arena_reset(HttpArena* arena);  // keeps one block for reuse
+void  http_arena_free(HttpArena* arena);
+
+// response headers
+bool  http_header_index_add(HttpHeaderIndex* index, char* line, size_t size);
+/*
+ * Add raw header line as received by CURLOPT_HEADERFUNCTION.
+ * Status line starts new response.
+ */
+void  http_header_index_reset(HttpHeaderIndex* index);
+void  http_header_index_free(HttpHeaderIndex* index);
+
+char* http_response_header(HttpRequestData* req, char* name);
+/*
+ * Return the value of header from the final response, nullptr if it is missing.
+ * If the header occurs multiple times, return the last one.
+ * The value is valid until the request is restarted or destroyed.
+ */
+char* http_response_header_latest(HttpRequestData* req, char* name);
+/*
+ * Same as above, but from any response, e.g. the last redirect Location.
+ */
 
 // utils
 UwResult urljoin_cstr(char* base_url, char* other_url);
 UwResult urljoin(UwValuePtr base_url, UwValuePtr other_url);
 
+// pre-parsed base URL
+void init_url_base_type();  // called by init_http
+
+UwResult url_base_create(UwValuePtr base_url);
+UwResult url_base_create_cstr(char* base_url);
+/*
+ * Parse base URL once for multiple joins.
+ * Return null if the URL is malformed.
+ */
+UwResult url_base_join(UwValuePtr url_base, UwValuePtr other_url);
+UwResult url_base_join_cstr(UwValuePtr url_base, char* other_url);
+/*
+ * Same as urljoin, but without parsing base URL.
+ * Fragments, and for http(s) base absolute paths and same-scheme //host references,
+ * are resolved without CURL, as long as CURL would not normalize them.
+ * Return null if other_url is malformed.
+ */
+UwResult url_base_join_list(UwValuePtr url_base, UwValuePtr urls);
+/*
+ * Join list of strings, return list of results in the same order.
+ * Malformed and non-string items are null in the result.
+ */
+
+// canonical URLs
+UwResult url_canonicalize(UwValuePtr url);
+UwResult url_canonicalize_cstr(char* url);
+/*
+ * Lowercase scheme and host, drop default port and fragment,
+ * normalize percent-encoding as RFC 3986 section 6.2.2 describes.
+ * Return null if the URL is malformed.
+ */
+bool url_fingerprint(UwValuePtr url, uint64_t* fingerprint);
+bool url_fingerprint_cstr(char* url, uint64_t* fingerprint);
+/*
+ * 64-bit hash of canonical URL. Return false if the URL is malformed.
+ */
+
+// seen set
+HttpSeenSet* http_create_seen_set(uint64_t capacity, char* path);
+/*
+ * If path is not nullptr, the table is mapped from that file
+ * and persists across runs; capacity is taken from the file if it exists.
+ * Capacity is rounded up to a power of two and limited to HTTP_SEEN_SET_MAX_CAPACITY.
+ */
+void http_delete_seen_set(HttpSeenSet* set);
+bool http_seen_set_contains(HttpSeenSet* set, uint64_t fingerprint);
+bool http_seen_set_add(HttpSeenSet* set, uint64_t fingerprint, bool* seen);
+/*
+ * Add fingerprint and set `seen` if it was already in the set.
+ * Return false if the set is full and cannot grow.
+ */
+bool http_seen_set_add_url(HttpSeenSet* set, UwValuePtr url, bool* seen);
+/*
+ * Same as above for URL. Malformed URLs are reported as seen.
+ */
+uint64_t http_seen_set_count(HttpSeenSet* set);
+
+// character classes of header grammar, see http_char_class
+#define HTTP_CHAR_CTL            0x01
+#define HTTP_CHAR_TOKEN          0x02  // not CTL or separator
+#define HTTP_CHAR_QDTEXT         0x04  // not quote, backslash, or CTL except HTAB
+#define HTTP_CHAR_MIME_CHARSETC  0x08
+#define HTTP_CHAR_ATTR_CHAR      0x10
+#define HTTP_CHAR_LWSP           0x20  // SP, HTAB, CR, LF
+
+extern const uint8_t http_char_class[256];
+
+char* http_scan_token(char* ptr);
+char* http_scan_qdtext(char* ptr);
+/*
+ * Return pointer to the first character that does not belong to the class.
+ * The string must be null-terminated.
+ * AVX2 or SSSE3 kernel is chosen on first call, if available.
+ */
+
+size_t http_ascii_prefix(uint8_t* data, size_t size);
+/*
+ * Return the number of leading ASCII bytes.
+ * Unlike scanners above, does not need a terminator.
+ */
+
+bool http_parse_media_type(char* header, HttpArena* arena, HttpHeaderView* view);
+bool http_parse_content_disposition(char* header, HttpArena* arena, HttpHeaderView* view);
+/*
+ * Zero-copy parsers, nothing is allocated unless quoted strings or ext-values need unescaping.
+ * Return false if header is malformed or out of memory.
+ */
+bool http_slice_equal(HttpSlice* slice, char* str);  // case-insensitive
+HttpHeaderParam* http_header_view_param(HttpHeaderView* view, char* name);
+/*
+ * Find parameter by name, case-insensitive.
+ * If both name and name* are present, return the latter.
+ */
+
+HttpHeaderView* http_request_content_type_view(HttpRequestData* req);
+HttpHeaderView* http_request_disposition_view(HttpRequestData* req);
+/*
+ * Parse headers on first call, zero-copy.
+ * Check `valid` field of the result, it's false if the header is missing or malformed.
+ */
+
+UwValuePtr http_request_media_type(HttpRequestData* req);
+UwValuePtr http_request_media_subtype(HttpRequestData* req);
+UwValuePtr http_request_media_type_params(HttpRequestData* req);
+UwValuePtr http_request_disposition_type(HttpRequestData* req);
+UwValuePtr http_request_disposition_params(HttpRequestData* req);
+/*
+ * Return parsed header fields, UW values are made on first call.
+ * Do not destroy returned values, clone them to keep.
+ */
+
 void http_request_parse_content_type(HttpRequestData* req);
 void http_request_parse_content_disposition(HttpRequestData* req);
 void http_request_parse_headers(HttpRequestData* req);
+/*
+ * Make UW values of parsed headers at once, if not made yet.
+ */
 
 UwResult http_request_get_filename(HttpRequestData* req);
@@ -0,0 +1,610 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * On-disk response cache
+ */
+
+static inline size_t index_size(uint64_t capacity)
+{
+    return sizeof(HttpCacheIndex) + capacity * sizeof(HttpCacheEntry);
+}
+
+static inline uint64_t entry_key(uint64_t fingerprint)
+/*
+ * Zero marks empty entries.
+ */
+{
+    return fingerprint? fingerprint : 1;
+}
+
+static HttpCacheEntry* find_entry(HttpCacheIndex* index, uint64_t key)
+/*
+ * Linear probing. Return the entry with the key or the empty one where it would go.
+ */
+{
+    uint64_t mask = index->capacity - 1;
+    uint64_t i = key & mask;
+    while (index->entries[i].key && index->entries[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &index->entries[i];
+}
+
+static void init_index(HttpCacheIndex* index, uint64_t capacity)
+{
+    index->magic    = HTTP_DISK_CACHE_MAGIC;
+    index->capacity = capacity;
+    index->count    = 0;
+    memset(index->entries, 0, capacity * sizeof(HttpCacheEntry));
+}
+
+static bool grow_index(HttpDiskCache* cache)
+/*
+ * Extend the file and its mapping, then rehash from a temporary copy of old entries.
+ */
+{
+    uint64_t old_capacity = cache->index->capacity;
+    size_t old_entries_size = old_capacity * sizeof(HttpCacheEntry);
+    size_t new_size = index_size(old_capacity * 2);
+
+    HttpCacheEntry* old_entries = _uw_default_allocator.alloc(old_entries_size);
+    if (!old_entries) {
+        return false;
+    }
+    memcpy(old_entries, cache->index->entries, old_entries_size);
+
+    if (ftruncate(cache->index_fd, new_size) == -1) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, strerror(errno));
+        _uw_default_allocator.free(old_entries, old_entries_size);
+        return false;
+    }
+    void* map = mremap(cache->index, cache->index_size, new_size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, strerror(errno));
+        // shrink back, otherwise the index is not recognized on next open
+        if (ftruncate(cache->index_fd, cache->index_size) == -1) {
+            perror(__func__);
+        }
+        _uw_default_allocator.free(old_entries, old_entries_size);
+        return false;
+    }
+    cache->index = (HttpCacheIndex*) map;
+    cache->index_size = new_size;
+
+    init_index(cache->index, old_capacity * 2);
+    for (uint64_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].key) {
+            *find_entry(cache->index, old_entries[i].key) = old_entries[i];
+            cache->index->count++;
+        }
+    }
+    _uw_default_allocator.free(old_entries, old_entries_size);
+    return true;
+}
+
+static bool open_index(HttpDiskCache* cache, char* path)
+/*
+ * Map existing index or create a new one.
+ */
+{
+    cache->index_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (cache->index_fd == -1) {
+        fprintf(stderr, "ERROR %s: cannot open %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(cache->index_fd, &st) == -1) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    uint64_t capacity = HTTP_DISK_CACHE_INITIAL_CAPACITY;
+    bool existing = st.st_size != 0;
+    if (existing) {
+        HttpCacheIndex header;
+        if (pread(cache->index_fd, &header, sizeof(header), 0) != sizeof(header)
+            || header.magic != HTTP_DISK_CACHE_MAGIC
+            || header.capacity == 0 || (header.capacity & (header.capacity - 1))
+            || (off_t) index_size(header.capacity) != st.st_size) {
+
+            fprintf(stderr, "ERROR %s: %s is not a cache index\n", __func__, path);
+            return false;
+        }
+        capacity = header.capacity;
+    } else if (ftruncate(cache->index_fd, index_size(capacity)) == -1) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    cache->index_size = index_size(capacity);
+    void* map = mmap(nullptr, cache->index_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->index_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    cache->index = (HttpCacheIndex*) map;
+    if (!existing) {
+        init_index(cache->index, capacity);
+    }
+    return true;
+}
+
+static void* writer_thread(void* arg);
+
+HttpDiskCache* http_create_disk_cache(char* directory)
+{
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "ERROR %s: cannot create %s: %s\n", __func__, directory, strerror(errno));
+        return nullptr;
+    }
+    HttpDiskCache* cache = _uw_default_allocator.alloc(sizeof(HttpDiskCache));
+    if (!cache) {
+        return nullptr;
+    }
+    *cache = (HttpDiskCache) {
+        .index_fd = -1,
+        .log_fd   = -1
+    };
+    pthread_mutex_init(&cache->lock, nullptr);
+    pthread_cond_init(&cache->cond, nullptr);
+
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/index", directory);
+    if (!open_index(cache, path)) {
+        http_delete_disk_cache(cache);
+        return nullptr;
+    }
+    snprintf(path, sizeof(path), "%s/log", directory);
+    cache->log_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (cache->log_fd == -1) {
+        fprintf(stderr, "ERROR %s: cannot open %s: %s\n", __func__, path, strerror(errno));
+        http_delete_disk_cache(cache);
+        return nullptr;
+    }
+    // records past the last indexed one were torn by a crash and are cut off
+    cache->log_end = 0;
+    for (uint64_t i = 0; i < cache->index->capacity; i++) {
+        HttpCacheEntry* entry = &cache->index->entries[i];
+        if (entry->key && (off_t) (entry->offset + entry->size) > cache->log_end) {
+            cache->log_end = entry->offset + entry->size;
+        }
+    }
+    if (ftruncate(cache->log_fd, cache->log_end) == -1) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        http_delete_disk_cache(cache);
+        return nullptr;
+    }
+    int err = pthread_create(&cache->writer, nullptr, writer_thread, cache);
+    if (err) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, strerror(err));
+        http_delete_disk_cache(cache);
+        return nullptr;
+    }
+    cache->writer_started = true;
+    return cache;
+}
+
+void http_delete_disk_cache(HttpDiskCache* cache)
+{
+    if (cache->writer_started) {
+        // the writer drains the queue before exiting
+        pthread_mutex_lock(&cache->lock);
+        cache->stop = true;
+        pthread_cond_signal(&cache->cond);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_join(cache->writer, nullptr);
+    }
+    if (cache->log_map) {
+        munmap(cache->log_map, cache->log_map_size);
+    }
+    if (cache->index) {
+        munmap(cache->index, cache->index_size);
+    }
+    if (cache->index_fd != -1) {
+        close(cache->index_fd);
+    }
+    if (cache->log_fd != -1) {
+        close(cache->log_fd);
+    }
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->lock);
+    _uw_default_allocator.free(cache, sizeof(HttpDiskCache));
+}
+
+static bool write_all(int fd, void* data, size_t size, off_t offset)
+{
+    uint8_t* ptr = (uint8_t*) data;
+    while (size) {
+        ssize_t n = pwrite(fd, ptr, size, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(__func__);
+            return false;
+        }
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static inline size_t record_fields_size(HttpCacheRecord* record)
+{
+    return record->etag_length + record->last_modified_length
+           + record->content_type_length + record->disposition_length;
+}
+
+static uint32_t update_checksum(uint32_t crc, uint8_t* data, size_t size)
+{
+    // crc32 takes uInt length
+    while (size) {
+        uInt n = (size < UINT_MAX)? (uInt) size : UINT_MAX;
+        crc = crc32(crc, data, n);
+        data += n;
+        size -= n;
+    }
+    return crc;
+}
+
+static bool add_conditional_header(HttpRequestData* req, char* name, char* value)
+{
+    char header[HTTP_CACHE_MAX_FIELD_SIZE + 32];
+    snprintf(header, sizeof(header), "%s: %s", name, value);
+    struct curl_slist* temp = curl_slist_append(req->conditional_headers, header);
+    if (!temp) {
+        return false;
+    }
+    req->conditional_headers = temp;
+    return true;
+}
+
+bool http_disk_cache_prepare(HttpDiskCache* cache, HttpRequestData* req)
+{
+    if (req->conditional_headers) {
+        curl_slist_free_all(req->conditional_headers);
+        req->conditional_headers = nullptr;
+    }
+    req->cache_offset = 0;
+    req->cache_size   = 0;
+    req->cache_store  = false;
+    req->from_cache   = false;
+
+    if (!cache || req->sink.type != HTTP_SINK_MEMORY || req->resume_pos || req->raw_content || req->decode_charset) {
+        return true;
+    }
+    if (!url_fingerprint(&req->url, &req->cache_key)) {
+        return true;
+    }
+    req->cache_store = true;
+
+    // validators are kept in the index, the log is not touched here
+    pthread_mutex_lock(&cache->lock);
+    HttpCacheEntry entry = *find_entry(cache->index, entry_key(req->cache_key));
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!entry.key) {
+        cache->misses++;
+        return true;
+    }
+    req->cache_offset = entry.offset;
+    req->cache_size   = entry.size;
+
+    if (entry.etag[0] && !add_conditional_header(req, "If-None-Match", entry.etag)) {
+        return false;
+    }
+    if (entry.last_modified[0] && !add_conditional_header(req, "If-Modified-Since", entry.last_modified)) {
+        return false;
+    }
+    return true;
+}
+
+static bool restore_header(HttpRequestData* req, char* name, char* value)
+/*
+ * Add header of cached response to the final one, unless 304 response has it.
+ */
+{
+    if (!value || http_response_header(req, name)) {
+        return true;
+    }
+    char line[HTTP_CACHE_MAX_FIELD_SIZE + 32];
+    int n = snprintf(line, sizeof(line), "%s: %s\r\n", name, value);
+    return http_header_index_add(&req->response_headers, line, n);
+}
+
+static uint8_t* map_record(HttpDiskCache* cache, HttpRequestData* req)
+/*
+ * Return pointer to the record in the log mapping, extending it if the record is past its end.
+ */
+{
+    uint64_t end = req->cache_offset + req->cache_size;
+    if (end > cache->log_map_size) {
+        // records are indexed after they are written, so the file is at least that long
+        struct stat st;
+        if (fstat(cache->log_fd, &st) == -1 || (uint64_t) st.st_size < end) {
+            return nullptr;
+        }
+        void* map = cache->log_map?
+            mremap(cache->log_map, cache->log_map_size, st.st_size, MREMAP_MAYMOVE)
+            : mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, cache->log_fd, 0);
+        if (map == MAP_FAILED) {
+            perror(__func__);
+            return nullptr;
+        }
+        cache->log_map = (uint8_t*) map;
+        cache->log_map_size = st.st_size;
+    }
+    return cache->log_map + req->cache_offset;
+}
+
+static bool fill_from_cache(HttpDiskCache* cache, HttpRequestData* req)
+{
+    uint8_t* ptr = map_record(cache, req);
+    if (!ptr) {
+        return false;
+    }
+    HttpCacheRecord record;
+    memcpy(&record, ptr, sizeof(HttpCacheRecord));
+    size_t fields_size = record_fields_size(&record);
+    if (record.magic != HTTP_CACHE_RECORD_MAGIC || record.fingerprint != req->cache_key
+        || sizeof(HttpCacheRecord) + fields_size + record.body_length != req->cache_size) {
+        return false;
+    }
+    char* fields = (char*) ptr + sizeof(HttpCacheRecord);
+    uint8_t* body = (uint8_t*) fields + fields_size;
+    if (update_checksum(crc32(0, nullptr, 0), (uint8_t*) fields, fields_size + record.body_length) != record.checksum) {
+        fprintf(stderr, "ERROR %s: corrupted record at %lu\n", __func__, (unsigned long) req->cache_offset);
+        return false;
+    }
+    char* content_type = fields + record.etag_length + record.last_modified_length;
+    char* disposition = content_type + record.content_type_length;
+    if (!restore_header(req, "Content-Type", record.content_type_length? content_type : nullptr)
+        || !restore_header(req, "Content-Disposition", record.disposition_length? disposition : nullptr)) {
+        return false;
+    }
+    UwValue content = uw_create_empty_string(record.body_length, 1);
+    if (uw_error(&content)) {
+        return false;
+    }
+    if (!uw_string_append_buffer(&content, body, record.body_length)) {
+        return false;
+    }
+    uw_destroy(&req->content);
+    req->content = uw_move(&content);
+    http_chunk_chain_free(&req->chunks);
+
+    // headers are parsed again on demand
+    req->content_type_view = (HttpHeaderView) {};
+    req->disposition_view  = (HttpHeaderView) {};
+    req->parsed_headers = 0;
+
+    req->status = record.status;
+    req->from_cache = true;
+    return true;
+}
+
+static bool set_field(HttpCacheRecord* record, uint16_t* length, char** value, HttpRequestData* req, char* name)
+/*
+ * Get header value for the record, lengths include terminating null.
+ */
+{
+    *value = http_response_header(req, name);
+    if (!*value) {
+        *length = 0;
+        return true;
+    }
+    size_t n = strlen(*value) + 1;
+    if (n > HTTP_CACHE_MAX_FIELD_SIZE) {
+        return false;
+    }
+    *length = (uint16_t) n;
+    return true;
+}
+
+static bool copy_segment(uint8_t* data, size_t size, void* arg)
+{
+    return http_chunk_chain_append((HttpChunkChain*) arg, data, size);
+}
+
+static void free_job(HttpCacheJob* job)
+{
+    http_chunk_chain_free(&job->body);
+    _uw_default_allocator.free(job, sizeof(HttpCacheJob) + job->header_size);
+}
+
+static void store_response(HttpDiskCache* cache, HttpRequestData* req)
+/*
+ * Queue the response for the writer thread.
+ * The body is in the chunk chain, see http_sink_open; the writer gets a copy of it.
+ */
+{
+    char* cache_control = http_response_header(req, "Cache-Control");
+    if (cache_control && strcasestr(cache_control, "no-store")) {
+        return;
+    }
+    HttpCacheRecord record = {
+        .magic       = HTTP_CACHE_RECORD_MAGIC,
+        .status      = req->status,
+        .fingerprint = req->cache_key,
+        .stored_time = time(nullptr),
+        .body_length = req->chunks.length
+    };
+    char* values[4];
+    if (!set_field(&record, &record.etag_length,          &values[0], req, "ETag")
+        || !set_field(&record, &record.last_modified_length, &values[1], req, "Last-Modified")
+        || !set_field(&record, &record.content_type_length,  &values[2], req, "Content-Type")
+        || !set_field(&record, &record.disposition_length,   &values[3], req, "Content-Disposition")) {
+        return;
+    }
+    // validators must fit the index entry
+    bool has_etag = record.etag_length && record.etag_length <= HTTP_CACHE_MAX_ETAG;
+    bool has_last_modified = record.last_modified_length
+                             && record.last_modified_length <= HTTP_CACHE_MAX_LAST_MODIFIED;
+    if (!has_etag && !has_last_modified) {
+        // cannot be revalidated
+        return;
+    }
+    size_t header_size = sizeof(HttpCacheRecord) + record_fields_size(&record);
+    HttpCacheJob* job = _uw_default_allocator.alloc(sizeof(HttpCacheJob) + header_size);
+    if (!job) {
+        return;
+    }
+    *job = (HttpCacheJob) {
+        .entry = { .key = entry_key(req->cache_key) },
+        .header_size = header_size
+    };
+    if (has_etag) {
+        memcpy(job->entry.etag, values[0], record.etag_length);
+    }
+    if (has_last_modified) {
+        memcpy(job->entry.last_modified, values[1], record.last_modified_length);
+    }
+    memcpy(job->header, &record, sizeof(HttpCacheRecord));
+    uint8_t* ptr = job->header + sizeof(HttpCacheRecord);
+    uint16_t lengths[4] = {
+        record.etag_length, record.last_modified_length, record.content_type_length, record.disposition_length
+    };
+    for (unsigned i = 0; i < 4; i++) {
+        if (lengths[i]) {
+            memcpy(ptr, values[i], lengths[i]);
+            ptr += lengths[i];
+        }
+    }
+    if (!http_chunk_chain_foreach(&req->chunks, copy_segment, &job->body)) {
+        free_job(job);
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    if (cache->jobs_tail) {
+        cache->jobs_tail->next = job;
+    } else {
+        cache->jobs_head = job;
+    }
+    cache->jobs_tail = job;
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+typedef struct {
+    int fd;
+    off_t offset;
+    uint32_t checksum;
+} LogWriter;
+
+static bool write_segment(uint8_t* data, size_t size, void* arg)
+{
+    LogWriter* writer = (LogWriter*) arg;
+    if (!write_all(writer->fd, data, size, writer->offset)) {
+        return false;
+    }
+    writer->offset += size;
+    return true;
+}
+
+static bool checksum_segment(uint8_t* data, size_t size, void* arg)
+{
+    LogWriter* writer = (LogWriter*) arg;
+    writer->checksum = update_checksum(writer->checksum, data, size);
+    return true;
+}
+
+static void write_job(HttpDiskCache* cache, HttpCacheJob* job)
+/*
+ * Append record to the log, sync it, then point index entry to it.
+ * If a crash happens before the index is updated, the record is cut off on next open.
+ */
+{
+    LogWriter writer = { .fd = cache->log_fd, .offset = cache->log_end };
+
+    writer.checksum = update_checksum(crc32(0, nullptr, 0), job->header + sizeof(HttpCacheRecord),
+                                      job->header_size - sizeof(HttpCacheRecord));
+    http_chunk_chain_foreach(&job->body, checksum_segment, &writer);
+    ((HttpCacheRecord*) job->header)->checksum = writer.checksum;
+
+    if (!write_segment(job->header, job->header_size, &writer)
+        || !http_chunk_chain_foreach(&job->body, write_segment, &writer)) {
+        return;
+    }
+    if (fdatasync(cache->log_fd) == -1) {
+        perror(__func__);
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    HttpCacheIndex* index = cache->index;
+    HttpCacheEntry* entry = find_entry(index, job->entry.key);
+    if (!entry->key && (index->count + 1) * 4 > index->capacity * 3) {
+        if (!grow_index(cache)) {
+            pthread_mutex_unlock(&cache->lock);
+            return;
+        }
+        entry = find_entry(cache->index, job->entry.key);
+    }
+    if (!entry->key) {
+        cache->index->count++;
+    }
+    *entry = job->entry;
+    entry->offset = cache->log_end;
+    entry->size   = writer.offset - cache->log_end;
+    cache->stored++;
+    pthread_mutex_unlock(&cache->lock);
+
+    cache->log_end = writer.offset;
+}
+
+static void* writer_thread(void* arg)
+{
+    HttpDiskCache* cache = (HttpDiskCache*) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&cache->lock);
+        while (!cache->stop && !cache->jobs_head) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+        }
+        HttpCacheJob* job = cache->jobs_head;
+        if (job) {
+            cache->jobs_head = job->next;
+            if (!cache->jobs_head) {
+                cache->jobs_tail = nullptr;
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+
+        if (!job) {
+            break;
+        }
+        write_job(cache, job);
+        free_job(job);
+    }
+    // free blocks pooled by this thread
+    http_chunk_pool_trim();
+    return nullptr;
+}
+
+void http_disk_cache_complete(HttpDiskCache* cache, HttpRequestData* req)
+{
+    if (req->status == 304 && req->cache_size) {
+        if (fill_from_cache(cache, req)) {
+            cache->revalidated++;
+        } else {
+            fprintf(stderr, "ERROR %s: cannot read cached response\n", __func__);
+        }
+    } else if (req->status == 200 && req->cache_store && req->sink.opened) {
+        store_response(cache, req);
+    }
+}
@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Conversion of text body to UTF-8
+ */
+
+static char replacement_char[] = "\xEF\xBF\xBD";  // U+FFFD in UTF-8
+
+static struct {
+    char* label;
+    char* name;
+} charset_aliases[] = {
+    // labels that mean a superset in practice, as browsers treat them
+    { "iso-8859-1", "WINDOWS-1252" },
+    { "iso8859-1",  "WINDOWS-1252" },
+    { "latin1",     "WINDOWS-1252" },
+    { "us-ascii",   "WINDOWS-1252" },
+    { "ascii",      "WINDOWS-1252" },
+    { "gb2312",     "GBK" },
+    { "x-sjis",     "SHIFT_JIS" }
+};
+
+static char* not_ascii_compatible[] = {
+    "utf-16", "utf-32", "ucs-2", "ucs-4", "utf-7", "iso-2022", "hz-",
+    "ebcdic", "ibm037", "cp037", "ibm500", "cp500", "ibm1047", "cp1047"
+};
+
+static char* ascii_safe[] = {
+    // bytes of multibyte sequences, if any, are never ASCII;
+    // not just "windows-", windows-31j and windows-936 have ASCII trail bytes
+    "iso-8859", "iso8859", "windows-125", "windows-874", "cp125", "cp874",
+    "koi8", "euc-", "mac", "ibm866", "cp866", "tis-620"
+};
+
+static bool has_prefix(char* name, char** prefixes, unsigned num_prefixes)
+{
+    for (unsigned i = 0; i < num_prefixes; i++) {
+        if (strncasecmp(name, prefixes[i], strlen(prefixes[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static HttpCharsetMode charset_mode(char* name)
+{
+    if (strcasecmp(name, "utf-8") == 0 || strcasecmp(name, "utf8") == 0) {
+        return HTTP_CHARSET_PASS;
+    }
+    if (has_prefix(name, not_ascii_compatible, sizeof(not_ascii_compatible) / sizeof(char*))) {
+        return HTTP_CHARSET_CONVERT;
+    }
+    if (has_prefix(name, ascii_safe, sizeof(ascii_safe) / sizeof(char*))) {
+        return HTTP_CHARSET_ASCII_RUNS;
+    }
+    // Shift_JIS, Big5, GBK and the like
+    return HTTP_CHARSET_ASCII_PREFIX;
+}
+
+static char* resolve_alias(char* name)
+{
+    for (unsigned i = 0; i < sizeof(charset_aliases) / sizeof(charset_aliases[0]); i++) {
+        if (strcasecmp(name, charset_aliases[i].label) == 0) {
+            return charset_aliases[i].name;
+        }
+    }
+    return name;
+}
+
+static bool charset_from_header(HttpRequestData* req, char* name)
+/*
+ * Take charset parameter of Content-Type, same as in media_type_params.
+ */
+{
+    HttpHeaderView* view = http_request_content_type_view(req);
+    if (!view->valid) {
+        return false;
+    }
+    HttpHeaderParam* param = http_header_view_param(view, "charset");
+    if (!param || param->value.length == 0 || param->value.length >= HTTP_CHARSET_MAX_NAME) {
+        return false;
+    }
+    memcpy(name, param->value.ptr, param->value.length);
+    name[param->value.length] = 0;
+    return true;
+}
+
+static char* sniff_bom(uint8_t* data, size_t size, unsigned* bom_length)
+{
+    if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) {
+        *bom_length = 3;
+        return "UTF-8";
+    }
+    if (size >= 2 && data[0] == 0xFE && data[1] == 0xFF) {
+        *bom_length = 2;
+        return "UTF-16BE";
+    }
+    if (size >= 2 && data[0] == 0xFF && data[1] == 0xFE) {
+        *bom_length = 2;
+        return "UTF-16LE";
+    }
+    return nullptr;
+}
+
+static bool is_html(HttpRequestData* req)
+/*
+ * Sniff meta tags if Content-Type says HTML or is missing.
+ */
+{
+    HttpHeaderView* view = http_request_content_type_view(req);
+    return !view->valid || http_slice_equal(&view->subtype, "html") || http_slice_equal(&view->subtype, "xhtml+xml");
+}
+
+static bool sniff_meta(uint8_t* data, size_t size, char* name)
+/*
+ * Find charset in <meta charset="..."> or <meta http-equiv="Content-Type" content="...; charset=...">.
+ */
+{
+    char* ptr = (char*) data;
+    char* end = ptr + ((size < HTTP_CHARSET_SNIFF_SIZE)? size : HTTP_CHARSET_SNIFF_SIZE);
+
+    while ((ptr = memchr(ptr, '<', end - ptr)) != nullptr) {
+        ptr++;
+        if (end - ptr < 4 || strncasecmp(ptr, "meta", 4) != 0) {
+            continue;
+        }
+        char* tag_end = memchr(ptr, '>', end - ptr);
+        if (!tag_end) {
+            tag_end = end;
+        }
+        for (char* p = ptr + 4; p + 7 <= tag_end; p++) {
+            if (strncasecmp(p, "charset", 7) != 0) {
+                continue;
+            }
+            p += 7;
+            while (p < tag_end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (p == tag_end || *p != '=') {
+                continue;
+            }
+            p++;
+            while (p < tag_end && (*p == ' ' || *p == '\t' || *p == '"' || *p == '\'')) {
+                p++;
+            }
+            unsigned n = 0;
+            while (p < tag_end && n < HTTP_CHARSET_MAX_NAME - 1
+                   && (isalnum((unsigned char) *p) || *p == '-' || *p == '_' || *p == '.' || *p == ':')) {
+                name[n++] = *p++;
+            }
+            if (n == 0) {
+                continue;
+            }
+            name[n] = 0;
+            if (strncasecmp(name, "utf-16", 6) == 0) {
+                // the document could not be parsed if it was UTF-16, HTML spec says to use UTF-8
+                strcpy(name, "UTF-8");
+            }
+            return true;
+        }
+        ptr = tag_end;
+    }
+    return false;
+}
+
+static size_t sniff_size(HttpRequestData* req)
+/*
+ * Return how many bytes of the body are needed to choose the charset.
+ */
+{
+    char name[HTTP_CHARSET_MAX_NAME];
+    if (charset_from_header(req, name) || !is_html(req)) {
+        // BOM only
+        return 3;
+    }
+    return HTTP_CHARSET_SNIFF_SIZE;
+}
+
+static unsigned start(HttpRequestData* req, uint8_t* data, size_t size)
+/*
+ * Choose the charset and return the length of BOM to skip.
+ */
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+    dec->started = true;
+    dec->mode = HTTP_CHARSET_PASS;
+
+    char name[HTTP_CHARSET_MAX_NAME];
+    unsigned bom_length = 0;
+    char* bom_charset = sniff_bom(data, size, &bom_length);
+
+    if (!charset_from_header(req, name)) {
+        if (bom_charset) {
+            strcpy(name, bom_charset);
+        } else if (!is_html(req) || !sniff_meta(data, size, name)) {
+            // unknown, keep as is
+            return 0;
+        }
+    }
+    unsigned skip = (bom_charset && strcasecmp(name, bom_charset) == 0)? bom_length : 0;
+
+    char* charset = resolve_alias(name);
+    HttpCharsetMode mode = charset_mode(charset);
+    if (mode != HTTP_CHARSET_PASS) {
+        dec->cd = iconv_open("UTF-8", charset);
+        if (dec->cd == (iconv_t) -1) {
+            // no message on the body write path, the caller checks the flag
+            req->charset_unsupported = true;
+            return 0;
+        }
+        dec->mode = mode;
+    }
+    req->content_is_utf8 = true;
+    return skip;
+}
+
+static inline bool write_utf8(HttpRequestData* req, void* data, size_t size)
+{
+    return http_sink_write(req, (uint8_t*) data, size) == size;
+}
+
+static bool convert(HttpRequestData* req, uint8_t* data, size_t size, size_t* consumed)
+/*
+ * Convert as much as possible, replacing invalid sequences with U+FFFD.
+ * Stop at incomplete sequence at the end of data.
+ */
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+    char buffer[HTTP_DECODER_BUFFER_SIZE];
+    char* in = (char*) data;
+    size_t in_left = size;
+
+    while (in_left) {
+        char* out = buffer;
+        size_t out_left = sizeof(buffer);
+        size_t rc = iconv(dec->cd, &in, &in_left, &out, &out_left);
+        int err = (rc == (size_t) -1)? errno : 0;
+        if (out != buffer && !write_utf8(req, buffer, out - buffer)) {
+            return false;
+        }
+        if (err == EILSEQ) {
+            if (!write_utf8(req, replacement_char, 3)) {
+                return false;
+            }
+            in++;
+            in_left--;
+        } else if (err == EINVAL) {
+            break;
+        } else if (err && err != E2BIG) {
+            return false;
+        }
+    }
+    *consumed = size - in_left;
+    return true;
+}
+
+static bool resolve_carry(HttpRequestData* req, uint8_t** data, size_t* size)
+/*
+ * Complete the sequence left from the previous chunk with leading bytes of this one.
+ */
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+    uint8_t buffer[sizeof(dec->carry) * 2];
+
+    size_t n = (*size < sizeof(dec->carry))? *size : sizeof(dec->carry);
+    size_t length = dec->carry_len + n;
+    memcpy(buffer, dec->carry, dec->carry_len);
+    memcpy(buffer + dec->carry_len, *data, n);
+
+    size_t consumed;
+    if (!convert(req, buffer, length, &consumed)) {
+        return false;
+    }
+    if (consumed >= dec->carry_len) {
+        *data += consumed - dec->carry_len;
+        *size -= consumed - dec->carry_len;
+        dec->carry_len = 0;
+        return true;
+    }
+    if (n == *size && length - consumed <= sizeof(dec->carry)) {
+        // still incomplete, the chunk is too short
+        memmove(dec->carry, buffer + consumed, length - consumed);
+        dec->carry_len = length - consumed;
+        *size = 0;
+        return true;
+    }
+    // no encoding has sequences that long
+    dec->carry_len = 0;
+    return write_utf8(req, replacement_char, 3);
+}
+
+static size_t conversion_run(uint8_t* data, size_t size)
+/*
+ * Return length of data to convert at once, up to the next ASCII run
+ * long enough to be copied separately.
+ */
+{
+    size_t pos = 0;
+    while (pos < size) {
+        while (pos < size && data[pos] >= 0x80) {
+            pos++;
+        }
+        size_t n = http_ascii_prefix(data + pos, size - pos);
+        if (n >= HTTP_CHARSET_MIN_ASCII_RUN) {
+            break;
+        }
+        pos += n;
+    }
+    return pos;
+}
+
+static bool decode(HttpRequestData* req, uint8_t* data, size_t size)
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+
+    if (dec->mode == HTTP_CHARSET_PASS) {
+        return size == 0 || write_utf8(req, data, size);
+    }
+    if (dec->carry_len && !resolve_carry(req, &data, &size)) {
+        return false;
+    }
+    bool chunk_start = true;
+    while (size) {
+        if (dec->carry_len == 0
+            && (dec->mode == HTTP_CHARSET_ASCII_RUNS || (dec->mode == HTTP_CHARSET_ASCII_PREFIX && chunk_start))) {
+
+            // fast path, ASCII is the same in UTF-8;
+            // short runs between words are left to iconv, separate calls would cost more
+            size_t n = http_ascii_prefix(data, size);
+            if (n == size || n >= HTTP_CHARSET_MIN_ASCII_RUN || dec->mode == HTTP_CHARSET_ASCII_PREFIX) {
+                if (n && !write_utf8(req, data, n)) {
+                    return false;
+                }
+                data += n;
+                size -= n;
+                if (size == 0) {
+                    break;
+                }
+            }
+        }
+        chunk_start = false;
+
+        size_t run = size;
+        if (dec->mode == HTTP_CHARSET_ASCII_RUNS) {
+            run = conversion_run(data, size);
+        }
+        size_t consumed;
+        if (!convert(req, data, run, &consumed)) {
+            return false;
+        }
+        if (consumed < run) {
+            size_t rest = run - consumed;
+            if (run == size && rest <= sizeof(dec->carry)) {
+                // incomplete sequence at the end of chunk
+                memcpy(dec->carry, data + consumed, rest);
+                dec->carry_len = rest;
+                break;
+            }
+            // incomplete sequence followed by ASCII is invalid
+            if (!write_utf8(req, replacement_char, 3)) {
+                return false;
+            }
+            consumed++;
+        }
+        data += consumed;
+        size -= consumed;
+    }
+    return true;
+}
+
+static bool start_buffered(HttpRequestData* req)
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+
+    unsigned skip = start(req, dec->head, dec->head_len);
+    bool ok = decode(req, dec->head + skip, dec->head_len - skip);
+    dec->head_len = 0;
+    return ok;
+}
+
+size_t http_charset_write(HttpRequestData* req, uint8_t* data, size_t size)
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+    size_t total = size;
+
+    if (!dec->started) {
+        size_t needed = sniff_size(req);
+        if (dec->head_len == 0 && size >= needed) {
+            unsigned skip = start(req, data, size);
+            data += skip;
+            size -= skip;
+        } else {
+            // the chunk is too short for sniffing, collect the beginning of the body
+            size_t n = needed - dec->head_len;
+            if (n > size) {
+                n = size;
+            }
+            memcpy(dec->head + dec->head_len, data, n);
+            dec->head_len += n;
+            data += n;
+            size -= n;
+            if (dec->head_len < needed) {
+                return total;
+            }
+            if (!start_buffered(req)) {
+                return 0;
+            }
+        }
+    }
+    if (!decode(req, data, size)) {
+        return 0;
+    }
+    return total;
+}
+
+void http_charset_close(HttpRequestData* req, bool success)
+{
+    HttpCharsetDecoder* dec = &req->charset_decoder;
+
+    if (!dec->started && dec->head_len && success) {
+        // the body is shorter than needed for sniffing
+        start_buffered(req);
+    }
+    if (dec->started && dec->mode != HTTP_CHARSET_PASS) {
+        if (success) {
+            if (dec->carry_len) {
+                // truncated body
+                write_utf8(req, replacement_char, 3);
+            }
+            // return to initial shift state, for stateful encodings
+            char buffer[16];
+            char* out = buffer;
+            size_t out_left = sizeof(buffer);
+            if (iconv(dec->cd, nullptr, nullptr, &out, &out_left) != (size_t) -1 && out != buffer) {
+                write_utf8(req, buffer, out - buffer);
+            }
+        }
+        iconv_close(dec->cd);
+    }
+    *dec = (HttpCharsetDecoder) {};
+}
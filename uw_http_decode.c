@@ -0,0 +1,311 @@
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+
+// optional codecs, build with -DHTTP_WITH_BROTLI and link -lbrotlidec,
+// build with -DHTTP_WITH_ZSTD and link -lzstd
+#ifdef HTTP_WITH_BROTLI
+#   include <brotli/decode.h>
+#endif
+
+#ifdef HTTP_WITH_ZSTD
+#   include <zstd.h>
+#endif
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Streaming decoder of raw content
+ */
+
+HttpContentEncoding http_parse_content_encoding(char* header)
+{
+    if (!header) {
+        return HTTP_ENCODING_IDENTITY;
+    }
+    static struct {
+        char* name;
+        HttpContentEncoding encoding;
+    } codings[] = {
+        { "identity", HTTP_ENCODING_IDENTITY },
+        { "gzip",     HTTP_ENCODING_GZIP },
+        { "x-gzip",   HTTP_ENCODING_GZIP },
+        { "deflate",  HTTP_ENCODING_DEFLATE },
+        { "br",       HTTP_ENCODING_BROTLI },
+        { "zstd",     HTTP_ENCODING_ZSTD }
+    };
+    // the value has no leading and trailing whitespace, see HttpResponseHeader
+    for (unsigned i = 0; i < sizeof(codings) / sizeof(codings[0]); i++) {
+        if (strcasecmp(header, codings[i].name) == 0) {
+            return codings[i].encoding;
+        }
+    }
+    return HTTP_ENCODING_UNKNOWN;
+}
+
+bool http_decoder_init(HttpDecoder* decoder, HttpContentEncoding encoding)
+{
+    *decoder = (HttpDecoder) { .encoding = encoding };
+
+    switch (encoding) {
+        case HTTP_ENCODING_IDENTITY:
+            return true;
+
+        case HTTP_ENCODING_GZIP:
+        case HTTP_ENCODING_DEFLATE: {
+            z_stream* zs = _uw_default_allocator.alloc(sizeof(z_stream));
+            if (!zs) {
+                return false;
+            }
+            *zs = (z_stream) {};
+            // gzip and zlib headers are detected automatically with 32 added to window bits
+            int window_bits = (encoding == HTTP_ENCODING_GZIP)? MAX_WBITS + 32 : MAX_WBITS;
+            if (inflateInit2(zs, window_bits) != Z_OK) {
+                _uw_default_allocator.free(zs, sizeof(z_stream));
+                return false;
+            }
+            decoder->state = zs;
+            return true;
+        }
+
+#       ifdef HTTP_WITH_BROTLI
+            case HTTP_ENCODING_BROTLI:
+                decoder->state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+                return decoder->state != nullptr;
+#       endif
+
+#       ifdef HTTP_WITH_ZSTD
+            case HTTP_ENCODING_ZSTD:
+                decoder->state = ZSTD_createDStream();
+                return decoder->state != nullptr;
+#       endif
+
+        default:
+            return false;
+    }
+}
+
+void http_decoder_fini(HttpDecoder* decoder)
+{
+    if (!decoder->state) {
+        return;
+    }
+    switch (decoder->encoding) {
+        case HTTP_ENCODING_GZIP:
+        case HTTP_ENCODING_DEFLATE:
+            inflateEnd((z_stream*) decoder->state);
+            _uw_default_allocator.free(decoder->state, sizeof(z_stream));
+            break;
+
+#       ifdef HTTP_WITH_BROTLI
+            case HTTP_ENCODING_BROTLI:
+                BrotliDecoderDestroyInstance((BrotliDecoderState*) decoder->state);
+                break;
+#       endif
+
+#       ifdef HTTP_WITH_ZSTD
+            case HTTP_ENCODING_ZSTD:
+                ZSTD_freeDStream((ZSTD_DStream*) decoder->state);
+                break;
+#       endif
+
+        default:
+            break;
+    }
+    decoder->state = nullptr;
+}
+
+static bool inflate_slice(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg)
+{
+    z_stream* zs = (z_stream*) decoder->state;
+    bool first_input = zs->total_in == 0;
+
+    zs->next_in  = data;
+    zs->avail_in = (uInt) size;
+
+    uint8_t buffer[HTTP_DECODER_BUFFER_SIZE];
+    while (!decoder->finished) {
+        zs->next_out  = buffer;
+        zs->avail_out = sizeof(buffer);
+
+        int rc = inflate(zs, Z_NO_FLUSH);
+        if (rc == Z_DATA_ERROR && decoder->encoding == HTTP_ENCODING_DEFLATE
+            && !decoder->raw_deflate && first_input && zs->total_out == 0) {
+
+            // no zlib header, try raw deflate from the beginning;
+            // this works if the first piece of input contains at least two bytes of the header
+            if (inflateReset2(zs, -MAX_WBITS) != Z_OK) {
+                return false;
+            }
+            decoder->raw_deflate = true;
+            zs->next_in  = data;
+            zs->avail_in = (uInt) size;
+            continue;
+        }
+        size_t n = sizeof(buffer) - zs->avail_out;
+        if (n && !output(buffer, n, arg)) {
+            return false;
+        }
+        if (rc == Z_STREAM_END) {
+            // trailing data is ignored, as CURL does
+            decoder->finished = true;
+        } else if (rc == Z_BUF_ERROR || (rc == Z_OK && zs->avail_in == 0 && zs->avail_out != 0)) {
+            // all input is consumed
+            break;
+        } else if (rc != Z_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool inflate_write(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg)
+/*
+ * zlib takes uInt lengths, feed larger input in slices.
+ */
+{
+    while (size > UINT_MAX) {
+        if (!inflate_slice(decoder, data, UINT_MAX, output, arg)) {
+            return false;
+        }
+        data += UINT_MAX;
+        size -= UINT_MAX;
+    }
+    return inflate_slice(decoder, data, size, output, arg);
+}
+
+#ifdef HTTP_WITH_BROTLI
+static bool brotli_write(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg)
+{
+    BrotliDecoderState* state = (BrotliDecoderState*) decoder->state;
+    const uint8_t* next_in = data;
+    size_t avail_in = size;
+
+    uint8_t buffer[HTTP_DECODER_BUFFER_SIZE];
+    while (!decoder->finished) {
+        uint8_t* next_out = buffer;
+        size_t avail_out = sizeof(buffer);
+
+        BrotliDecoderResult rc = BrotliDecoderDecompressStream(state, &avail_in, &next_in,
+                                                               &avail_out, &next_out, nullptr);
+        if (rc == BROTLI_DECODER_RESULT_ERROR) {
+            return false;
+        }
+        size_t n = sizeof(buffer) - avail_out;
+        if (n && !output(buffer, n, arg)) {
+            return false;
+        }
+        if (rc == BROTLI_DECODER_RESULT_SUCCESS) {
+            decoder->finished = true;
+        } else if (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+            break;
+        }
+        // otherwise, needs more output
+    }
+    return true;
+}
+#endif
+
+#ifdef HTTP_WITH_ZSTD
+static bool zstd_write(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg)
+/*
+ * Zstd stream may consist of multiple frames, `finished` is set at the end of each one.
+ */
+{
+    ZSTD_DStream* state = (ZSTD_DStream*) decoder->state;
+    ZSTD_inBuffer in = { .src = data, .size = size, .pos = 0 };
+
+    uint8_t buffer[HTTP_DECODER_BUFFER_SIZE];
+    for (;;) {
+        ZSTD_outBuffer out = { .dst = buffer, .size = sizeof(buffer), .pos = 0 };
+
+        size_t rc = ZSTD_decompressStream(state, &out, &in);
+        if (ZSTD_isError(rc)) {
+            return false;
+        }
+        if (out.pos && !output(buffer, out.pos, arg)) {
+            return false;
+        }
+        decoder->finished = rc == 0;
+        if (in.pos == in.size && out.pos < out.size) {
+            // all input is consumed and nothing is left buffered
+            break;
+        }
+    }
+    return true;
+}
+#endif
+
+bool http_decoder_write(HttpDecoder* decoder, uint8_t* data, size_t size, HttpSegmentVisitor output, void* arg)
+{
+    switch (decoder->encoding) {
+        case HTTP_ENCODING_IDENTITY:
+            return output(data, size, arg);
+
+        case HTTP_ENCODING_GZIP:
+        case HTTP_ENCODING_DEFLATE:
+            return inflate_write(decoder, data, size, output, arg);
+
+#       ifdef HTTP_WITH_BROTLI
+            case HTTP_ENCODING_BROTLI:
+                return brotli_write(decoder, data, size, output, arg);
+#       endif
+
+#       ifdef HTTP_WITH_ZSTD
+            case HTTP_ENCODING_ZSTD:
+                return zstd_write(decoder, data, size, output, arg);
+#       endif
+
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    HttpDecoder* decoder;
+    _UwValue* result;
+} DecodeContext;
+
+static bool append_decoded(uint8_t* data, size_t size, void* arg)
+{
+    return uw_string_append_buffer((UwValuePtr) arg, data, size);
+}
+
+static bool decode_segment(uint8_t* data, size_t size, void* arg)
+{
+    DecodeContext* ctx = (DecodeContext*) arg;
+    return http_decoder_write(ctx->decoder, data, size, append_decoded, ctx->result);
+}
+
+UwResult http_request_decode_content(HttpRequestData* req)
+{
+    if (req->content_encoding == HTTP_ENCODING_IDENTITY) {
+        return http_request_flatten_content(req);
+    }
+    if (!req->chunks.first) {
+        // nothing received, or flattened already
+        return UwNull();
+    }
+    HttpDecoder decoder;
+    if (!http_decoder_init(&decoder, req->content_encoding)) {
+        return UwNull();
+    }
+    // compressed text expands a few times, but already compressed payloads do not,
+    // so reserve the encoded length and let the string grow
+    UwValue result = uw_create_empty_string(req->chunks.length, 1);
+    if (uw_error(&result)) {
+        http_decoder_fini(&decoder);
+        return uw_move(&result);
+    }
+    DecodeContext ctx = { .decoder = &decoder, .result = &result };
+    bool ok = http_chunk_chain_foreach(&req->chunks, decode_segment, &ctx) && decoder.finished;
+    http_decoder_fini(&decoder);
+    if (!ok) {
+        return UwNull();
+    }
+    return uw_move(&result);
+}
@@ -0,0 +1,221 @@
+#include <string.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Arena
+ */
+
+void* http_arena_alloc(HttpArena* arena, size_t size)
+{
+    size = (size + 7) & ~((size_t) 7);
+
+    HttpArenaBlock* block = arena->blocks;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = (size > HTTP_ARENA_BLOCK_SIZE)? size : HTTP_ARENA_BLOCK_SIZE;
+        block = _uw_default_allocator.alloc(sizeof(HttpArenaBlock) + block_size);
+        if (!block) {
+            return nullptr;
+        }
+        block->next = arena->blocks;
+        block->size = block_size;
+        block->used = 0;
+        arena->blocks = block;
+    }
+    void* result = &block->data[block->used];
+    block->used += size;
+    return result;
+}
+
+void http_arena_reset(HttpArena* arena)
+{
+    HttpArenaBlock* block = arena->blocks;
+    if (!block) {
+        return;
+    }
+    // keep the oldest block, it is of default size unless some allocation was huge
+    while (block->next) {
+        HttpArenaBlock* next = block->next;
+        _uw_default_allocator.free(block, sizeof(HttpArenaBlock) + block->size);
+        block = next;
+    }
+    block->used = 0;
+    arena->blocks = block;
+}
+
+void http_arena_free(HttpArena* arena)
+{
+    HttpArenaBlock* block = arena->blocks;
+    while (block) {
+        HttpArenaBlock* next = block->next;
+        _uw_default_allocator.free(block, sizeof(HttpArenaBlock) + block->size);
+        block = next;
+    }
+    arena->blocks = nullptr;
+}
+
+/****************************************************************
+ * Response header index
+ */
+
+static inline char fold_char(char c)
+{
+    return ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+}
+
+static inline bool is_ows(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline uint32_t hash_char(uint32_t hash, char c)
+/*
+ * FNV-1a step
+ */
+{
+    return (hash ^ (unsigned char) c) * 16777619u;
+}
+
+static char* trim(char* start, char** end)
+{
+    while (start < *end && is_ows(*start)) {
+        start++;
+    }
+    while (*end > start && (is_ows((*end)[-1]) || (*end)[-1] == '\r' || (*end)[-1] == '\n')) {
+        (*end)--;
+    }
+    return start;
+}
+
+static bool append_continuation(HttpHeaderIndex* index, char* start, char* end)
+/*
+ * Obsolete line folding: append to the value of the last header, separated by space.
+ */
+{
+    HttpResponseHeader* hdr = index->last;
+    start = trim(start, &end);
+    size_t len = end - start;
+    if (len == 0) {
+        return true;
+    }
+    char* value = http_arena_alloc(&index->arena, hdr->value_len + len + 2);
+    if (!value) {
+        return false;
+    }
+    memcpy(value, hdr->value, hdr->value_len);
+    value[hdr->value_len] = ' ';
+    memcpy(value + hdr->value_len + 1, start, len);
+    hdr->value_len += len + 1;
+    value[hdr->value_len] = 0;
+    hdr->value = value;
+    return true;
+}
+
+bool http_header_index_add(HttpHeaderIndex* index, char* line, size_t size)
+{
+    char* end = line + size;
+
+    if (size >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        index->num_responses++;
+        index->last = nullptr;
+        return true;
+    }
+    if (size && is_ows(line[0])) {
+        if (index->last) {
+            return append_continuation(index, line, end);
+        }
+        return true;
+    }
+    char* colon = memchr(line, ':', size);
+    if (!colon || colon == line) {
+        // blank line at the end of headers or garbage
+        return true;
+    }
+    char* value = trim(colon + 1, &end);
+    size_t name_len = colon - line;
+    size_t value_len = end - value;
+
+    HttpResponseHeader* hdr = http_arena_alloc(&index->arena, sizeof(HttpResponseHeader) + name_len + value_len + 2);
+    if (!hdr) {
+        return false;
+    }
+    hdr->name  = (char*) (hdr + 1);
+    hdr->value = hdr->name + name_len + 1;
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name_len; i++) {
+        char c = fold_char(line[i]);
+        hdr->name[i] = c;
+        hash = hash_char(hash, c);
+    }
+    hdr->name[name_len] = 0;
+    memcpy(hdr->value, value, value_len);
+    hdr->value[value_len] = 0;
+
+    hdr->hash      = hash;
+    hdr->name_len  = name_len;
+    hdr->value_len = value_len;
+    hdr->response  = index->num_responses;
+
+    HttpResponseHeader** bucket = &index->buckets[hash & (HTTP_HEADER_INDEX_SIZE - 1)];
+    hdr->next = *bucket;
+    *bucket = hdr;
+    index->last = hdr;
+    return true;
+}
+
+void http_header_index_reset(HttpHeaderIndex* index)
+{
+    http_arena_reset(&index->arena);
+    memset(index->buckets, 0, sizeof(index->buckets));
+    index->last = nullptr;
+    index->num_responses = 0;
+}
+
+void http_header_index_free(HttpHeaderIndex* index)
+{
+    http_arena_free(&index->arena);
+    memset(index->buckets, 0, sizeof(index->buckets));
+    index->last = nullptr;
+    index->num_responses = 0;
+}
+
+static HttpResponseHeader* find_header(HttpHeaderIndex* index, char* name)
+{
+    uint32_t hash = 2166136261u;
+    size_t name_len = 0;
+    for (char* p = name; *p; p++) {
+        hash = hash_char(hash, fold_char(*p));
+        name_len++;
+    }
+    for (HttpResponseHeader* hdr = index->buckets[hash & (HTTP_HEADER_INDEX_SIZE - 1)]; hdr; hdr = hdr->next) {
+        if (hdr->hash != hash || hdr->name_len != name_len) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < name_len && hdr->name[i] == fold_char(name[i])) {
+            i++;
+        }
+        if (i == name_len) {
+            return hdr;
+        }
+    }
+    return nullptr;
+}
+
+char* http_response_header(HttpRequestData* req, char* name)
+{
+    HttpResponseHeader* hdr = find_header(&req->response_headers, name);
+    if (hdr && hdr->response == req->response_headers.num_responses) {
+        return hdr->value;
+    }
+    return nullptr;
+}
+
+char* http_response_header_latest(HttpRequestData* req, char* name)
+{
+    HttpResponseHeader* hdr = find_header(&req->response_headers, name);
+    return hdr? hdr->value : nullptr;
+}
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Non-blocking event log
+ */
+
+HttpLogRing* http_create_log_ring()
+{
+    HttpLogRing* ring = _uw_default_allocator.alloc(sizeof(HttpLogRing));
+    if (!ring) {
+        return nullptr;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    return ring;
+}
+
+void http_delete_log_ring(HttpLogRing* ring)
+{
+    _uw_default_allocator.free(ring, sizeof(HttpLogRing));
+}
+
+void http_log_event(HttpLogRing* ring, HttpLogLevel level, HttpRequestData* req)
+/*
+ * Single producer: the thread that runs the session.
+ * If the ring is full, the event is dropped.
+ */
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == HTTP_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    HttpLogEvent* event = &ring->events[head & (HTTP_LOG_RING_SIZE - 1)];
+
+    event->level      = level;
+    event->status     = req->status;
+    event->result     = req->result;
+    event->total_time = req->timing.total;
+
+    char* url = nullptr;
+    if (req->easy_handle) {
+        curl_easy_getinfo(req->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
+    }
+    if (!url && uw_is_string(&req->url)) {
+        // the request was not started
+        UW_CSTRING_LOCAL(url_cstr, &req->url);
+        strncpy(event->url, url_cstr, HTTP_LOG_URL_SIZE - 1);
+        event->url[HTTP_LOG_URL_SIZE - 1] = 0;
+    } else if (url) {
+        size_t n = strlen(url);
+        if (n >= HTTP_LOG_URL_SIZE) {
+            n = HTTP_LOG_URL_SIZE - 1;
+        }
+        memcpy(event->url, url, n);
+        event->url[n] = 0;
+    } else {
+        event->url[0] = 0;
+    }
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+unsigned http_log_ring_drain(HttpLogRing* ring, HttpLogHandler handler, void* arg, unsigned max)
+/*
+ * Single consumer.
+ */
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned n = 0;
+    while (tail != head && n < max) {
+        handler(&ring->events[tail & (HTTP_LOG_RING_SIZE - 1)], arg);
+        tail++;
+        n++;
+        // release the slot right away, so the producer does not drop events while handler is slow
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return n;
+}
+
+void http_log_print_event(HttpLogEvent* event, void* file)
+{
+    if (event->result == CURLE_OK) {
+        fprintf((FILE*) file, "STATUS %u: %s (%.3fs)\n",
+                event->status, event->url, event->total_time / 1000000.0);
+    } else {
+        fprintf((FILE*) file, "FAILED %s: %s\n", event->url, curl_easy_strerror(event->result));
+    }
+}
+
+static void* log_thread(void* arg)
+{
+    HttpSession* session = (HttpSession*) arg;
+
+    struct timespec interval = {
+        .tv_sec  = 0,
+        .tv_nsec = HTTP_LOG_DRAIN_INTERVAL * 1000000L
+    };
+    for (;;) {
+        bool stop = atomic_load_explicit(&session->log_thread_stop, memory_order_acquire);
+        http_log_ring_drain(session->log_ring, http_log_print_event, session->log_file, UINT_MAX);
+        if (stop) {
+            break;
+        }
+        uint64_t dropped = atomic_exchange_explicit(&session->log_ring->dropped, 0, memory_order_relaxed);
+        if (dropped) {
+            fprintf(session->log_file, "WARNING: %lu log events dropped\n", (unsigned long) dropped);
+        }
+        fflush(session->log_file);
+        nanosleep(&interval, nullptr);
+    }
+    fflush(session->log_file);
+    return nullptr;
+}
+
+bool http_session_start_log_thread(void* session, FILE* file)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    if (!sess->log_ring || sess->log_thread_started) {
+        return false;
+    }
+    sess->log_file = file;
+    atomic_store(&sess->log_thread_stop, false);
+    int err = pthread_create(&sess->log_thread, nullptr, log_thread, sess);
+    if (err) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, strerror(err));
+        return false;
+    }
+    sess->log_thread_started = true;
+    sess->config.log_file = file;
+    return true;
+}
+
+void http_session_stop_log_thread(void* session)
+{
+    HttpSession* sess = (HttpSession*) session;
+
+    if (!sess->log_thread_started) {
+        return;
+    }
+    atomic_store_explicit(&sess->log_thread_stop, true, memory_order_release);
+    pthread_join(sess->log_thread, nullptr);
+    sess->log_thread_started = false;
+    sess->config.log_file = nullptr;
+}
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * In-memory LRU response cache
+ */
+
+static uint64_t monotonic_time()
+/*
+ * Return microseconds.
+ */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline bool is_cacheable(HttpRequestData* req)
+/*
+ * Responses to requests with credentials or custom headers may differ for the same URL.
+ */
+{
+    return req->sink.type == HTTP_SINK_MEMORY && req->resume_pos == 0
+           && !req->segmented_content && !req->raw_content && !req->decode_charset
+           && uw_is_null(&req->cookie) && !req->extra_headers;
+}
+
+HttpMemoryCache* http_create_memory_cache(size_t budget)
+{
+    HttpMemoryCache* cache = _uw_default_allocator.alloc(sizeof(HttpMemoryCache));
+    if (!cache) {
+        return nullptr;
+    }
+    *cache = (HttpMemoryCache) {
+        .capacity = HTTP_MEMORY_CACHE_INITIAL_BUCKETS,
+        .budget   = budget
+    };
+    cache->buckets = _uw_default_allocator.alloc(cache->capacity * sizeof(HttpMemoryCacheEntry*));
+    if (!cache->buckets) {
+        _uw_default_allocator.free(cache, sizeof(HttpMemoryCache));
+        return nullptr;
+    }
+    memset(cache->buckets, 0, cache->capacity * sizeof(HttpMemoryCacheEntry*));
+    return cache;
+}
+
+static void free_entry(HttpMemoryCacheEntry* entry)
+{
+    size_t alloc_size = entry->alloc_size;
+    uw_destroy(&entry->content);
+    _uw_default_allocator.free(entry, alloc_size);
+}
+
+void http_delete_memory_cache(HttpMemoryCache* cache)
+{
+    HttpMemoryCacheEntry* entry = cache->lru_head;
+    while (entry) {
+        HttpMemoryCacheEntry* next = entry->lru_next;
+        free_entry(entry);
+        entry = next;
+    }
+    _uw_default_allocator.free(cache->buckets, cache->capacity * sizeof(HttpMemoryCacheEntry*));
+    _uw_default_allocator.free(cache, sizeof(HttpMemoryCache));
+}
+
+static HttpMemoryCacheEntry* find_entry(HttpMemoryCache* cache, uint64_t key, HttpHeaderProfile* profile)
+{
+    HttpMemoryCacheEntry* entry = cache->buckets[key & (cache->capacity - 1)];
+    while (entry && (entry->key != key || entry->profile != profile)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static void lru_unlink(HttpMemoryCache* cache, HttpMemoryCacheEntry* entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(HttpMemoryCache* cache, HttpMemoryCacheEntry* entry)
+{
+    entry->lru_prev = nullptr;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static void remove_entry(HttpMemoryCache* cache, HttpMemoryCacheEntry* entry)
+{
+    HttpMemoryCacheEntry** link = &cache->buckets[entry->key & (cache->capacity - 1)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    lru_unlink(cache, entry);
+    cache->used -= entry->size;
+    cache->count--;
+    free_entry(entry);
+}
+
+static void grow_buckets(HttpMemoryCache* cache)
+/*
+ * Double the number of buckets. If out of memory, chains just get longer.
+ */
+{
+    unsigned new_capacity = cache->capacity * 2;
+    HttpMemoryCacheEntry** new_buckets = _uw_default_allocator.alloc(new_capacity * sizeof(HttpMemoryCacheEntry*));
+    if (!new_buckets) {
+        return;
+    }
+    memset(new_buckets, 0, new_capacity * sizeof(HttpMemoryCacheEntry*));
+    for (HttpMemoryCacheEntry* entry = cache->lru_head; entry; entry = entry->lru_next) {
+        HttpMemoryCacheEntry** bucket = &new_buckets[entry->key & (new_capacity - 1)];
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    _uw_default_allocator.free(cache->buckets, cache->capacity * sizeof(HttpMemoryCacheEntry*));
+    cache->buckets  = new_buckets;
+    cache->capacity = new_capacity;
+}
+
+static bool add_header(HttpRequestData* req, char* name, char* value)
+{
+    char line[HTTP_CACHE_MAX_FIELD_SIZE + 32];
+    int n = snprintf(line, sizeof(line), "%s: %s\r\n", name, value);
+    return http_header_index_add(&req->response_headers, line, n);
+}
+
+static bool fill_request(HttpRequestData* req, HttpMemoryCacheEntry* entry)
+/*
+ * Make the request look like finished transfer.
+ */
+{
+    static char status_line[] = "HTTP/1.1 200 OK\r\n";
+
+    http_header_index_reset(&req->response_headers);
+    req->content_type_view = (HttpHeaderView) {};
+    req->disposition_view  = (HttpHeaderView) {};
+    req->parsed_headers = 0;
+
+    if (!http_header_index_add(&req->response_headers, status_line, sizeof(status_line) - 1)
+        || !add_header(req, "Content-Type", entry->headers)) {
+        return false;
+    }
+    if (entry->disposition_offset) {
+        if (!add_header(req, "Content-Disposition", entry->headers + entry->disposition_offset)) {
+            return false;
+        }
+    }
+    uw_destroy(&req->content);
+    req->content = uw_clone(&entry->content);
+    http_chunk_chain_free(&req->chunks);
+
+    uw_destroy(&req->real_url);
+    req->real_url = uw_clone(&req->url);
+
+    req->sink.opened = false;
+    req->timing = (HttpRequestTiming) {};
+    req->status = 200;
+    req->result = CURLE_OK;
+    req->from_cache = true;
+    return true;
+}
+
+bool http_memory_cache_lookup(HttpMemoryCache* cache, HttpRequestData* req, HttpHeaderProfile* profile)
+{
+    if (!is_cacheable(req)) {
+        return false;
+    }
+    uint64_t key;
+    if (!url_fingerprint(&req->url, &key)) {
+        return false;
+    }
+    HttpMemoryCacheEntry* entry = find_entry(cache, key, profile);
+    if (entry && entry->expires <= monotonic_time()) {
+        remove_entry(cache, entry);
+        entry = nullptr;
+    }
+    if (!entry || !fill_request(req, entry)) {
+        cache->misses++;
+        return false;
+    }
+    lru_unlink(cache, entry);
+    lru_push_front(cache, entry);
+    cache->hits++;
+    return true;
+}
+
+static bool get_max_age(char* cache_control, uint64_t* max_age)
+/*
+ * Parse Cache-Control directives.
+ * Return false if there's no max-age or the response must be revalidated.
+ */
+{
+    bool found = false;
+    char* ptr = cache_control;
+    for (;;) {
+        while (*ptr == ' ' || *ptr == '\t' || *ptr == ',') {
+            ptr++;
+        }
+        if (*ptr == 0) {
+            return found;
+        }
+        char* name = ptr;
+        while (*ptr && *ptr != '=' && *ptr != ',' && *ptr != ' ' && *ptr != '\t') {
+            ptr++;
+        }
+        size_t name_len = ptr - name;
+        if ((name_len == 8 && strncasecmp(name, "no-store", 8) == 0)
+            || (name_len == 8 && strncasecmp(name, "no-cache", 8) == 0)) {
+            return false;
+        }
+        while (*ptr == ' ' || *ptr == '\t') {
+            ptr++;
+        }
+        if (*ptr != '=') {
+            continue;
+        }
+        ptr++;
+        while (*ptr == ' ' || *ptr == '\t') {
+            ptr++;
+        }
+        bool quoted = *ptr == '"';
+        if (quoted) {
+            ptr++;
+        }
+        char* value = ptr;
+        if (name_len == 7 && strncasecmp(name, "max-age", 7) == 0) {
+            char* end;
+            unsigned long long n = strtoull(value, &end, 10);
+            if (end == value) {
+                // malformed, treat as stale
+                return false;
+            }
+            // RFC 9111 says to take values this large as infinity
+            *max_age = (n < 2147483648ULL)? n : 2147483648ULL;
+            found = true;
+        }
+        // skip the rest of value
+        if (quoted) {
+            while (*ptr && *ptr != '"') {
+                if (*ptr == '\\' && ptr[1]) {
+                    ptr++;
+                }
+                ptr++;
+            }
+        }
+        while (*ptr && *ptr != ',') {
+            ptr++;
+        }
+    }
+}
+
+static bool varies(char* vary)
+/*
+ * Check if Vary lists anything but Accept-Encoding, which CURL handles the same way for all requests.
+ */
+{
+    char* ptr = vary;
+    for (;;) {
+        while (*ptr == ' ' || *ptr == '\t' || *ptr == ',') {
+            ptr++;
+        }
+        if (*ptr == 0) {
+            return false;
+        }
+        char* name = ptr;
+        while (*ptr && *ptr != ',' && *ptr != ' ' && *ptr != '\t') {
+            ptr++;
+        }
+        if (ptr - name != 15 || strncasecmp(name, "accept-encoding", 15) != 0) {
+            return true;
+        }
+    }
+}
+
+void http_memory_cache_store(HttpMemoryCache* cache, HttpRequestData* req, HttpHeaderProfile* profile)
+{
+    if (req->status != 200 || !is_cacheable(req) || !uw_is_string(&req->content)) {
+        return;
+    }
+    char* cache_control = http_response_header(req, "Cache-Control");
+    uint64_t max_age;
+    if (!cache_control || !get_max_age(cache_control, &max_age)) {
+        return;
+    }
+    char* age = http_response_header(req, "Age");
+    if (age) {
+        // the time the response spent in upstream caches
+        uint64_t n = strtoull(age, nullptr, 10);
+        max_age = (n < max_age)? max_age - n : 0;
+    }
+    if (max_age == 0) {
+        return;
+    }
+    char* vary = http_response_header(req, "Vary");
+    if (vary && varies(vary)) {
+        return;
+    }
+    if (!http_request_content_type_view(req)->valid) {
+        return;
+    }
+    char* content_type = http_response_header(req, "Content-Type");
+    char* disposition  = http_response_header(req, "Content-Disposition");
+    size_t content_type_size = strlen(content_type) + 1;
+    size_t disposition_size  = disposition? strlen(disposition) + 1 : 0;
+    if (content_type_size > HTTP_CACHE_MAX_FIELD_SIZE || disposition_size > HTTP_CACHE_MAX_FIELD_SIZE) {
+        return;
+    }
+    size_t alloc_size = sizeof(HttpMemoryCacheEntry) + content_type_size + disposition_size;
+    size_t size = alloc_size + uw_strlen(&req->content);
+    if (size > cache->budget) {
+        return;
+    }
+    uint64_t key;
+    if (!url_fingerprint(&req->url, &key)) {
+        return;
+    }
+    HttpMemoryCacheEntry* existing = find_entry(cache, key, profile);
+    if (existing) {
+        remove_entry(cache, existing);
+    }
+    while (cache->used + size > cache->budget) {
+        remove_entry(cache, cache->lru_tail);
+        cache->evicted++;
+    }
+    HttpMemoryCacheEntry* entry = _uw_default_allocator.alloc(alloc_size);
+    if (!entry) {
+        return;
+    }
+    if (cache->count >= cache->capacity) {
+        grow_buckets(cache);
+    }
+    *entry = (HttpMemoryCacheEntry) {
+        .key        = key,
+        .profile    = profile,
+        .expires    = monotonic_time() + max_age * 1000000,
+        .size       = size,
+        .alloc_size = alloc_size,
+        .content    = uw_clone(&req->content),
+        .disposition_offset = disposition? content_type_size : 0
+    };
+    memcpy(entry->headers, content_type, content_type_size);
+    if (disposition) {
+        memcpy(entry->headers + content_type_size, disposition, disposition_size);
+    }
+    HttpMemoryCacheEntry** bucket = &cache->buckets[key & (cache->capacity - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    lru_push_front(cache, entry);
+    cache->used += size;
+    cache->count++;
+    cache->stored++;
+}
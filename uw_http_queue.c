@@ -0,0 +1,61 @@
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * FIFO queue of values
+ */
+
+static bool grow_queue(HttpValueQueue* queue)
+{
+    unsigned new_capacity = queue->capacity? queue->capacity * 2 : 256;
+    _UwValue* new_items = _uw_default_allocator.alloc(new_capacity * sizeof(_UwValue));
+    if (!new_items) {
+        return false;
+    }
+    for (unsigned i = 0; i < queue->count; i++) {
+        new_items[i] = queue->items[(queue->head + i) % queue->capacity];
+    }
+    if (queue->items) {
+        _uw_default_allocator.free(queue->items, queue->capacity * sizeof(_UwValue));
+    }
+    queue->items = new_items;
+    queue->capacity = new_capacity;
+    queue->head = 0;
+    return true;
+}
+
+bool http_value_queue_push(HttpValueQueue* queue, UwValuePtr value)
+{
+    if (queue->count == queue->capacity) {
+        if (!grow_queue(queue)) {
+            return false;
+        }
+    }
+    unsigned tail = (queue->head + queue->count) % queue->capacity;
+    queue->items[tail] = uw_move(value);
+    queue->count++;
+    return true;
+}
+
+UwResult http_value_queue_pop(HttpValueQueue* queue)
+{
+    if (queue->count == 0) {
+        return UwNull();
+    }
+    UwValuePtr item = &queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return uw_move(item);
+}
+
+void http_value_queue_fini(HttpValueQueue* queue)
+{
+    while (queue->count) {
+        UwValue item = http_value_queue_pop(queue);
+    }
+    if (queue->items) {
+        _uw_default_allocator.free(queue->items, queue->capacity * sizeof(_UwValue));
+    }
+    *queue = (HttpValueQueue) {};
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Multi-threaded session runner
+ */
+
+void http_runner_default_config(HttpRunnerConfig* config)
+{
+    *config = (HttpRunnerConfig) {
+        .num_workers = 4,
+        .max_transfers_per_worker = 100
+    };
+    http_session_default_config(&config->session_config);
+}
+
+static void push_completion(HttpRunner* runner, UwValuePtr request)
+/*
+ * Push request to the lock-free completion stack and notify the caller.
+ */
+{
+    HttpCompletion* node = _uw_default_allocator.alloc(sizeof(HttpCompletion));
+    if (!node) {
+        fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+        uw_destroy(request);
+        atomic_fetch_sub_explicit(&runner->pending, 1, memory_order_relaxed);
+        return;
+    }
+    node->request = uw_move(request);
+    node->next = atomic_load_explicit(&runner->completed, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&runner->completed, &node->next, node,
+                                                  memory_order_release, memory_order_relaxed)) {}
+
+    uint64_t one = 1;
+    if (write(runner->completion_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror(__func__);
+    }
+}
+
+static void worker_done(void* session, UwValuePtr request, void* arg)
+/*
+ * Session callback, called in worker thread.
+ * Take the session's reference, the caller thread becomes the only owner.
+ */
+{
+    HttpRunner* runner = (HttpRunner*) arg;
+    push_completion(runner, request);
+}
+
+static void* worker_thread(void* arg)
+{
+    HttpRunnerWorker* worker = (HttpRunnerWorker*) arg;
+    HttpRunner* runner = worker->runner;
+    HttpSession* session = (HttpSession*) worker->session;
+
+    for (;;) {
+        _UwValue batch[HTTP_RUNNER_BATCH_SIZE];
+        unsigned n = 0;
+        unsigned active = session->active_transfers + session->pending.count + session->hosts.deferred
+                          + session->cache_hits.count;
+
+        pthread_mutex_lock(&runner->queue_lock);
+        while (!runner->stop && active == 0 && runner->queue.count == 0) {
+            runner->idle_workers++;
+            pthread_cond_wait(&runner->queue_cond, &runner->queue_lock);
+            runner->idle_workers--;
+        }
+        bool stop = runner->stop;
+        if (!stop) {
+            // take as many requests as this worker can run
+            while (n < HTTP_RUNNER_BATCH_SIZE
+                   && active + n < runner->config.max_transfers_per_worker
+                   && runner->queue.count) {
+                batch[n++] = http_value_queue_pop(&runner->queue);
+            }
+        }
+        pthread_mutex_unlock(&runner->queue_lock);
+
+        if (stop && active == 0) {
+            break;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            if (!add_http_request(session, &batch[i])) {
+                HttpRequestData* req = (HttpRequestData*) batch[i].extra_data;
+                req->result = CURLE_FAILED_INIT;
+                push_completion(runner, &batch[i]);
+            }
+            uw_destroy(&batch[i]);
+        }
+        int running_transfers;
+        if (!http_perform(session, &running_transfers)) {
+            fprintf(stderr, "ERROR %s: worker %u stopped\n", __func__, worker->index);
+            break;
+        }
+    }
+    // free blocks pooled by this thread
+    http_chunk_pool_trim();
+    return nullptr;
+}
+
+HttpRunner* http_create_runner(HttpRunnerConfig* config)
+{
+    HttpRunner* runner = _uw_default_allocator.alloc(sizeof(HttpRunner));
+    if (!runner) {
+        return nullptr;
+    }
+    *runner = (HttpRunner) {
+        .config = *config,
+        .completion_fd = -1
+    };
+    pthread_mutex_init(&runner->queue_lock, nullptr);
+    pthread_cond_init(&runner->queue_cond, nullptr);
+
+    runner->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (runner->completion_fd == -1) {
+        perror(__func__);
+        http_delete_runner(runner);
+        return nullptr;
+    }
+    if (runner->config.num_workers == 0) {
+        runner->config.num_workers = 1;
+    }
+    runner->workers = _uw_default_allocator.alloc(runner->config.num_workers * sizeof(HttpRunnerWorker));
+    if (!runner->workers) {
+        http_delete_runner(runner);
+        return nullptr;
+    }
+    for (unsigned i = 0; i < runner->config.num_workers; i++) {
+        runner->workers[i] = (HttpRunnerWorker) {
+            .runner = runner,
+            .index  = i
+        };
+    }
+    for (unsigned i = 0; i < runner->config.num_workers; i++) {
+        HttpRunnerWorker* worker = &runner->workers[i];
+        worker->session = create_http_session_with_config(&config->session_config);
+        if (!worker->session) {
+            http_delete_runner(runner);
+            return nullptr;
+        }
+        if (config->shared_cache) {
+            http_session_attach_shared_cache(worker->session, config->shared_cache);
+        }
+        http_session_set_done_callback(worker->session, worker_done, runner);
+
+        int err = pthread_create(&worker->thread, nullptr, worker_thread, worker);
+        if (err) {
+            fprintf(stderr, "ERROR %s: %s\n", __func__, strerror(err));
+            http_delete_runner(runner);
+            return nullptr;
+        }
+        worker->started = true;
+        runner->num_workers++;
+    }
+    return runner;
+}
+
+void http_delete_runner(HttpRunner* runner)
+/*
+ * Stop workers after their active transfers are finished.
+ * Queued and not drained requests are destroyed.
+ */
+{
+    pthread_mutex_lock(&runner->queue_lock);
+    runner->stop = true;
+    pthread_cond_broadcast(&runner->queue_cond);
+    pthread_mutex_unlock(&runner->queue_lock);
+
+    if (runner->workers) {
+        for (unsigned i = 0; i < runner->config.num_workers; i++) {
+            HttpRunnerWorker* worker = &runner->workers[i];
+            if (worker->started) {
+                pthread_join(worker->thread, nullptr);
+            }
+            if (worker->session) {
+                delete_http_session(worker->session);
+            }
+        }
+        _uw_default_allocator.free(runner->workers, runner->config.num_workers * sizeof(HttpRunnerWorker));
+    }
+    http_value_queue_fini(&runner->queue);
+
+    // drop completions
+    HttpCompletion* node = atomic_exchange(&runner->completed, nullptr);
+    while (node) {
+        HttpCompletion* next = node->next;
+        uw_destroy(&node->request);
+        _uw_default_allocator.free(node, sizeof(HttpCompletion));
+        node = next;
+    }
+    node = runner->drained;
+    while (node) {
+        HttpCompletion* next = node->next;
+        uw_destroy(&node->request);
+        _uw_default_allocator.free(node, sizeof(HttpCompletion));
+        node = next;
+    }
+    if (runner->completion_fd != -1) {
+        close(runner->completion_fd);
+    }
+    pthread_cond_destroy(&runner->queue_cond);
+    pthread_mutex_destroy(&runner->queue_lock);
+    _uw_default_allocator.free(runner, sizeof(HttpRunner));
+}
+
+bool http_runner_submit(HttpRunner* runner, UwValuePtr request)
+{
+    pthread_mutex_lock(&runner->queue_lock);
+    if (!http_value_queue_push(&runner->queue, request)) {
+        pthread_mutex_unlock(&runner->queue_lock);
+        return false;
+    }
+    atomic_fetch_add_explicit(&runner->pending, 1, memory_order_relaxed);
+
+    void* busy_session = nullptr;
+    if (runner->idle_workers) {
+        pthread_cond_signal(&runner->queue_cond);
+    } else {
+        busy_session = runner->workers[runner->next_wakeup++ % runner->num_workers].session;
+    }
+    pthread_mutex_unlock(&runner->queue_lock);
+
+    if (busy_session) {
+        // all workers are busy, interrupt one of them to pick up the request sooner
+        http_session_wakeup(busy_session);
+    }
+    return true;
+}
+
+unsigned http_runner_drain(HttpRunner* runner, UwValuePtr out_list, unsigned max)
+{
+    if (!runner->drained) {
+        // reset notification before taking completions, so that no one is missed
+        uint64_t count;
+        if (read(runner->completion_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+            perror(__func__);
+        }
+        // take whole stack and reverse it to get completion order
+        HttpCompletion* node = atomic_exchange_explicit(&runner->completed, nullptr, memory_order_acquire);
+        while (node) {
+            HttpCompletion* next = node->next;
+            node->next = runner->drained;
+            runner->drained = node;
+            node = next;
+        }
+    }
+    unsigned n = 0;
+    while (n < max && runner->drained) {
+        HttpCompletion* node = runner->drained;
+        if (!uw_list_append(out_list, &node->request)) {
+            break;
+        }
+        runner->drained = node->next;
+        uw_destroy(&node->request);
+        _uw_default_allocator.free(node, sizeof(HttpCompletion));
+        n++;
+    }
+    atomic_fetch_sub_explicit(&runner->pending, n, memory_order_relaxed);
+    return n;
+}
+
+unsigned http_runner_pending(HttpRunner* runner)
+{
+    return atomic_load_explicit(&runner->pending, memory_order_relaxed);
+}
+
+int http_runner_completion_fd(HttpRunner* runner)
+{
+    return runner->completion_fd;
+}
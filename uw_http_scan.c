@@ -0,0 +1,291 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HTTP_SCAN_X86
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#   define HTTP_SCAN_ASAN
+#elif defined(__has_feature)
+#   if __has_feature(address_sanitizer)
+#       define HTTP_SCAN_ASAN
+#   endif
+#endif
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Character classes of RFC 7230 header grammar
+ */
+
+#define CC_IS_CTL(c)  ((c) <= 31 || (c) == 127)
+
+#define CC_IS_SEPARATOR(c)  \
+    ((c) == '(' || (c) == ')' || (c) == '<' || (c) == '>'  || (c) == '@' || \
+     (c) == ',' || (c) == ';' || (c) == ':' || (c) == '\\' || (c) == '"' || \
+     (c) == '/' || (c) == '[' || (c) == ']' || (c) == '?'  || (c) == '=' || \
+     (c) == '{' || (c) == '}' || (c) == ' ' || (c) == '\t')
+
+#define CC_IS_ALNUM(c)  \
+    (('0' <= (c) && (c) <= '9') || ('a' <= (c) && (c) <= 'z') || ('A' <= (c) && (c) <= 'Z'))
+
+#define CC_IS_MIME_CHARSETC(c)  \
+    (CC_IS_ALNUM(c) || \
+     (c) == '!' || (c) == '#' || (c) == '$' || (c) == '%' || (c) == '&' || \
+     (c) == '+' || (c) == '-' || (c) == '^' || (c) == '_' || (c) == '`' || \
+     (c) == '{' || (c) == '}' || (c) == '~')
+
+#define CC_IS_ATTR_CHAR(c)  \
+    (CC_IS_ALNUM(c) || \
+     (c) == '!' || (c) == '#' || (c) == '$' || (c) == '&' || (c) == '+' || (c) == '-' || (c) == '.' || \
+     (c) == '^' || (c) == '_' || (c) == '`' || (c) == '|' || (c) == '~')
+
+#define CC_IS_LWSP(c)  ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+#define CC_CLASS(c) (uint8_t) ( \
+    (CC_IS_CTL(c)? HTTP_CHAR_CTL : 0) | \
+    ((CC_IS_CTL(c) || CC_IS_SEPARATOR(c))? 0 : HTTP_CHAR_TOKEN) | \
+    (((c) == '"' || (c) == '\\' || (CC_IS_CTL(c) && (c) != '\t'))? 0 : HTTP_CHAR_QDTEXT) | \
+    (CC_IS_MIME_CHARSETC(c)? HTTP_CHAR_MIME_CHARSETC : 0) | \
+    (CC_IS_ATTR_CHAR(c)? HTTP_CHAR_ATTR_CHAR : 0) | \
+    (CC_IS_LWSP(c)? HTTP_CHAR_LWSP : 0))
+
+#define CC_ROW(n)  \
+    CC_CLASS((n) + 0),  CC_CLASS((n) + 1),  CC_CLASS((n) + 2),  CC_CLASS((n) + 3),  \
+    CC_CLASS((n) + 4),  CC_CLASS((n) + 5),  CC_CLASS((n) + 6),  CC_CLASS((n) + 7),  \
+    CC_CLASS((n) + 8),  CC_CLASS((n) + 9),  CC_CLASS((n) + 10), CC_CLASS((n) + 11), \
+    CC_CLASS((n) + 12), CC_CLASS((n) + 13), CC_CLASS((n) + 14), CC_CLASS((n) + 15)
+
+const uint8_t http_char_class[256] = {
+    CC_ROW(0),   CC_ROW(16),  CC_ROW(32),  CC_ROW(48),
+    CC_ROW(64),  CC_ROW(80),  CC_ROW(96),  CC_ROW(112),
+    CC_ROW(128), CC_ROW(144), CC_ROW(160), CC_ROW(176),
+    CC_ROW(192), CC_ROW(208), CC_ROW(224), CC_ROW(240)
+};
+
+/****************************************************************
+ * Scanning kernels
+ *
+ * Stop characters are classified by nibble lookup:
+ * a byte is a stop one if lo_table[low nibble] & hi_table[high nibble] is not zero.
+ * Bytes 0x80-0xFF are never stop characters.
+ *
+ * Vector kernels load aligned blocks, so they never cross page boundary,
+ * and rely on null terminator which is a stop character for all sets.
+ * Such reads past the terminator are not instrumented by AddressSanitizer,
+ * and under it the scalar kernel is chosen, so that parsers are checked
+ * for reading past the end of string. See bench/http_scan_diff.c for vector kernels.
+ */
+
+typedef struct {
+    uint8_t lo_table[16];
+    uint8_t hi_table[16];
+    uint8_t char_class;  // scalar fallback: characters of this class are not stop ones
+} ScanSet;
+
+static const ScanSet token_stop_set = {
+    // bits: 0x01 - CTL 0x00-0x1F, 0x02 - 0x2_, 0x04 - 0x3_, 0x08 - 0x4_, 0x10 - 0x5_, 0x20 - 0x7_
+    //                 0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F
+    .lo_table   = { 0x0B, 0x01, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x03, 0x03, 0x05, 0x35, 0x17, 0x35, 0x05, 0x27 },
+    .hi_table   = { 0x01, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    .char_class = HTTP_CHAR_TOKEN
+};
+
+static const ScanSet qdtext_stop_set = {
+    // bits: 0x01 - CTL 0x00-0x0F except HTAB, 0x02 - CTL 0x10-0x1F, 0x04 - 0x2_, 0x08 - 0x5_, 0x10 - 0x7_
+    //                 0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F
+    .lo_table   = { 0x03, 0x03, 0x07, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x02, 0x03, 0x03, 0x0B, 0x03, 0x03, 0x13 },
+    .hi_table   = { 0x01, 0x02, 0x04, 0x00, 0x00, 0x08, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    .char_class = HTTP_CHAR_QDTEXT
+};
+
+static char* scan_scalar(char* ptr, const ScanSet* set)
+{
+    while (http_char_class[(unsigned char) *ptr] & set->char_class) {
+        ptr++;
+    }
+    return ptr;
+}
+
+#ifdef HTTP_SCAN_X86
+
+__attribute__((target("ssse3"), no_sanitize_address))
+static char* scan_ssse3(char* ptr, const ScanSet* set)
+{
+    __m128i lo_lut = _mm_loadu_si128((__m128i*) set->lo_table);
+    __m128i hi_lut = _mm_loadu_si128((__m128i*) set->hi_table);
+    __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    __m128i zero = _mm_setzero_si128();
+
+    unsigned misalignment = (uintptr_t) ptr & 15;
+    char* block = ptr - misalignment;
+    uint32_t valid_mask = (0xFFFFu << misalignment) & 0xFFFFu;  // skip bytes before ptr
+    for (;;) {
+        __m128i v = _mm_load_si128((__m128i*) block);
+        __m128i lo = _mm_and_si128(v, nibble_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask);
+        __m128i cls = _mm_and_si128(_mm_shuffle_epi8(lo_lut, lo), _mm_shuffle_epi8(hi_lut, hi));
+        uint32_t stop = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(cls, zero)) & valid_mask;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        block += 16;
+        valid_mask = 0xFFFFu;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static char* scan_avx2(char* ptr, const ScanSet* set)
+{
+    __m256i lo_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*) set->lo_table));
+    __m256i hi_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*) set->hi_table));
+    __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    __m256i zero = _mm256_setzero_si256();
+
+    unsigned misalignment = (uintptr_t) ptr & 31;
+    char* block = ptr - misalignment;
+    uint32_t valid_mask = 0xFFFFFFFFu << misalignment;  // skip bytes before ptr
+    for (;;) {
+        __m256i v = _mm256_load_si256((__m256i*) block);
+        __m256i lo = _mm256_and_si256(v, nibble_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble_mask);
+        __m256i cls = _mm256_and_si256(_mm256_shuffle_epi8(lo_lut, lo), _mm256_shuffle_epi8(hi_lut, hi));
+        uint32_t stop = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(cls, zero)) & valid_mask;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        block += 32;
+        valid_mask = 0xFFFFFFFFu;
+    }
+}
+
+#endif
+
+typedef char* (*ScanFunc)(char* ptr, const ScanSet* set);
+
+static char* scan_resolve(char* ptr, const ScanSet* set);
+
+static _Atomic ScanFunc scan = scan_resolve;
+
+static char* scan_resolve(char* ptr, const ScanSet* set)
+/*
+ * Choose the kernel on first call.
+ * Concurrent calls store the same value, atomic store makes that well-defined.
+ */
+{
+    ScanFunc func = scan_scalar;
+#   if defined(HTTP_SCAN_X86) && !defined(HTTP_SCAN_ASAN)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            func = scan_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            func = scan_ssse3;
+        }
+#   endif
+    atomic_store_explicit(&scan, func, memory_order_relaxed);
+    return func(ptr, set);
+}
+
+char* http_scan_token(char* ptr)
+{
+    return atomic_load_explicit(&scan, memory_order_relaxed)(ptr, &token_stop_set);
+}
+
+char* http_scan_qdtext(char* ptr)
+{
+    return atomic_load_explicit(&scan, memory_order_relaxed)(ptr, &qdtext_stop_set);
+}
+
+/****************************************************************
+ * ASCII prefix
+ *
+ * Bounded by size, so blocks are loaded unaligned and the tail is scanned by scalar code.
+ */
+
+static size_t ascii_prefix_scalar(uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        if (v & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    while (i < size && data[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef HTTP_SCAN_X86
+
+__attribute__((target("sse2")))
+static size_t ascii_prefix_sse2(uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((__m128i*) (data + i)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + ascii_prefix_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        // check two blocks at once, most text is all ASCII
+        __m256i a = _mm256_loadu_si256((__m256i*) (data + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (data + i + 32));
+        if (_mm256_movemask_epi8(_mm256_or_si256(a, b))) {
+            break;
+        }
+    }
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_loadu_si256((__m256i*) (data + i)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + ascii_prefix_scalar(data + i, size - i);
+}
+
+#endif
+
+typedef size_t (*AsciiPrefixFunc)(uint8_t* data, size_t size);
+
+static size_t ascii_prefix_resolve(uint8_t* data, size_t size);
+
+static _Atomic AsciiPrefixFunc ascii_prefix = ascii_prefix_resolve;
+
+static size_t ascii_prefix_resolve(uint8_t* data, size_t size)
+/*
+ * Same as scan_resolve.
+ */
+{
+    AsciiPrefixFunc func = ascii_prefix_scalar;
+#   ifdef HTTP_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            func = ascii_prefix_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            func = ascii_prefix_sse2;
+        }
+#   endif
+    atomic_store_explicit(&ascii_prefix, func, memory_order_relaxed);
+    return func(data, size);
+}
+
+size_t http_ascii_prefix(uint8_t* data, size_t size)
+{
+    return atomic_load_explicit(&ascii_prefix, memory_order_relaxed)(data, size);
+}
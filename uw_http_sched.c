@@ -0,0 +1,453 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Priority queue of pending requests, binary heap
+ */
+
+static inline bool goes_before(HttpPendingRequest* a, HttpPendingRequest* b)
+/*
+ * Higher priority first, FIFO within the same priority.
+ */
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->seq < b->seq;
+}
+
+static inline void swap_items(HttpPendingRequest* a, HttpPendingRequest* b)
+{
+    HttpPendingRequest tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+bool http_pending_push(HttpPendingQueue* queue, UwValuePtr request, int priority)
+{
+    if (queue->count == queue->capacity) {
+        unsigned new_capacity = queue->capacity? queue->capacity * 2 : 256;
+        HttpPendingRequest* new_items = _uw_default_allocator.alloc(new_capacity * sizeof(HttpPendingRequest));
+        if (!new_items) {
+            return false;
+        }
+        for (unsigned i = 0; i < queue->count; i++) {
+            new_items[i] = queue->items[i];
+        }
+        if (queue->items) {
+            _uw_default_allocator.free(queue->items, queue->capacity * sizeof(HttpPendingRequest));
+        }
+        queue->items = new_items;
+        queue->capacity = new_capacity;
+    }
+    unsigned i = queue->count++;
+    queue->items[i] = (HttpPendingRequest) {
+        .priority = priority,
+        .seq      = queue->next_seq++,
+        .request  = uw_move(request)
+    };
+    // sift up
+    while (i) {
+        unsigned parent = (i - 1) / 2;
+        if (!goes_before(&queue->items[i], &queue->items[parent])) {
+            break;
+        }
+        swap_items(&queue->items[i], &queue->items[parent]);
+        i = parent;
+    }
+    return true;
+}
+
+UwResult http_pending_pop(HttpPendingQueue* queue)
+{
+    if (queue->count == 0) {
+        return UwNull();
+    }
+    UwValue result = uw_move(&queue->items[0].request);
+
+    queue->count--;
+    if (queue->count) {
+        queue->items[0] = queue->items[queue->count];
+        // sift down
+        unsigned i = 0;
+        for (;;) {
+            unsigned left  = 2 * i + 1;
+            unsigned right = left + 1;
+            unsigned first = i;
+            if (left < queue->count && goes_before(&queue->items[left], &queue->items[first])) {
+                first = left;
+            }
+            if (right < queue->count && goes_before(&queue->items[right], &queue->items[first])) {
+                first = right;
+            }
+            if (first == i) {
+                break;
+            }
+            swap_items(&queue->items[i], &queue->items[first]);
+            i = first;
+        }
+    }
+    return uw_move(&result);
+}
+
+void http_pending_fini(HttpPendingQueue* queue)
+{
+    for (unsigned i = 0; i < queue->count; i++) {
+        uw_destroy(&queue->items[i].request);
+    }
+    if (queue->items) {
+        _uw_default_allocator.free(queue->items, queue->capacity * sizeof(HttpPendingRequest));
+    }
+    *queue = (HttpPendingQueue) {};
+}
+
+/****************************************************************
+ * Per-host limits: token buckets and timer wheel
+ */
+
+static uint64_t monotonic_time()
+/*
+ * Return microseconds.
+ */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint64_t time_to_tick(uint64_t t)
+{
+    return t / (HTTP_HOST_WHEEL_TICK * 1000);
+}
+
+static uint64_t hash_origin(char* origin)
+/*
+ * FNV-1a
+ */
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char* p = (unsigned char*) origin; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool get_origin(char* url, char* origin, size_t size)
+/*
+ * Write scheme://host:port to origin.
+ */
+{
+    CURLU* handle = curl_url();
+    if (!handle) {
+        return false;
+    }
+    char* scheme = nullptr;
+    char* host = nullptr;
+    char* port = nullptr;
+
+    bool result = curl_url_set(handle, CURLUPART_URL, url, 0) == CURLUE_OK
+                  && curl_url_get(handle, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK
+                  && curl_url_get(handle, CURLUPART_HOST, &host, 0) == CURLUE_OK
+                  && curl_url_get(handle, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK;
+    if (result) {
+        int n = snprintf(origin, size, "%s://%s:%s", scheme, host, port);
+        result = n > 0 && (size_t) n < size;
+    }
+    curl_free(scheme);
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(handle);
+    return result;
+}
+
+static bool grow_host_table(HttpHostScheduler* hosts)
+{
+    unsigned new_capacity = hosts->capacity? hosts->capacity * 2 : 64;
+    HttpHost** new_table = _uw_default_allocator.alloc(new_capacity * sizeof(HttpHost*));
+    if (!new_table) {
+        return false;
+    }
+    memset(new_table, 0, new_capacity * sizeof(HttpHost*));
+    for (unsigned i = 0; i < hosts->capacity; i++) {
+        HttpHost* host = hosts->table[i];
+        if (host) {
+            unsigned j = host->hash & (new_capacity - 1);
+            while (new_table[j]) {
+                j = (j + 1) & (new_capacity - 1);
+            }
+            new_table[j] = host;
+        }
+    }
+    if (hosts->table) {
+        _uw_default_allocator.free(hosts->table, hosts->capacity * sizeof(HttpHost*));
+    }
+    hosts->table = new_table;
+    hosts->capacity = new_capacity;
+    return true;
+}
+
+HttpHost* http_host_lookup(HttpHostScheduler* hosts, char* url)
+{
+    char origin[512];
+    if (!get_origin(url, origin, sizeof(origin))) {
+        return nullptr;
+    }
+    uint64_t hash = hash_origin(origin);
+
+    if (hosts->capacity) {
+        unsigned i = hash & (hosts->capacity - 1);
+        HttpHost* host;
+        while ((host = hosts->table[i]) != nullptr) {
+            if (host->hash == hash && strcmp(host->origin, origin) == 0) {
+                return host;
+            }
+            i = (i + 1) & (hosts->capacity - 1);
+        }
+    }
+    if ((hosts->count + 1) * 4 > hosts->capacity * 3) {
+        if (!grow_host_table(hosts)) {
+            return nullptr;
+        }
+    }
+    size_t origin_size = strlen(origin) + 1;
+    HttpHost* host = _uw_default_allocator.alloc(sizeof(HttpHost) + origin_size);
+    if (!host) {
+        return nullptr;
+    }
+    *host = (HttpHost) {
+        .state       = HTTP_HOST_IDLE,
+        .tokens      = -1.0,  // token bucket is filled on first use
+        .hash        = hash
+    };
+    memcpy(host->origin, origin, origin_size);
+
+    unsigned i = hash & (hosts->capacity - 1);
+    while (hosts->table[i]) {
+        i = (i + 1) & (hosts->capacity - 1);
+    }
+    hosts->table[i] = host;
+    hosts->count++;
+    return host;
+}
+
+static void refill_tokens(HttpHost* host, HttpSessionConfig* config, uint64_t now)
+{
+    double burst = config->host_burst? (double) config->host_burst : 1.0;
+    if (host->tokens < 0.0) {
+        host->tokens = burst;
+    } else if (now > host->refill_time) {
+        host->tokens += (now - host->refill_time) * config->host_rate / 1000000.0;
+        if (host->tokens > burst) {
+            host->tokens = burst;
+        }
+    }
+    host->refill_time = now;
+}
+
+static bool can_start(HttpHost* host, HttpSessionConfig* config, uint64_t now)
+{
+    if (config->max_host_transfers && host->active_transfers >= config->max_host_transfers) {
+        return false;
+    }
+    if (config->host_rate > 0.0) {
+        refill_tokens(host, config, now);
+        if (host->tokens < 1.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool http_host_admit(HttpHost* host, HttpSessionConfig* config)
+{
+    return host->state == HTTP_HOST_IDLE && can_start(host, config, monotonic_time());
+}
+
+void http_host_started(HttpHost* host, HttpSessionConfig* config)
+{
+    if (config->host_rate > 0.0) {
+        refill_tokens(host, config, monotonic_time());
+        host->tokens -= 1.0;
+    }
+    host->active_transfers++;
+}
+
+static void make_ready(HttpHostScheduler* hosts, HttpHost* host)
+{
+    host->state = HTTP_HOST_READY;
+    host->next = nullptr;
+    if (hosts->ready_tail) {
+        hosts->ready_tail->next = host;
+    } else {
+        hosts->ready_head = host;
+    }
+    hosts->ready_tail = host;
+}
+
+static void wheel_insert(HttpHostScheduler* hosts, HttpHost* host, uint64_t now)
+{
+    if (hosts->wheel_count == 0) {
+        hosts->wheel_tick = time_to_tick(now);
+    }
+    uint64_t tick = time_to_tick(host->due_time);
+    if (tick <= hosts->wheel_tick) {
+        tick = hosts->wheel_tick + 1;
+    }
+    // hosts due beyond wheel horizon are put back when their slot comes round
+    unsigned slot = tick & (HTTP_HOST_WHEEL_SLOTS - 1);
+    host->state = HTTP_HOST_WAIT_TIMER;
+    host->next = hosts->wheel[slot];
+    hosts->wheel[slot] = host;
+    hosts->wheel_count++;
+}
+
+static void wait_host(HttpHostScheduler* hosts, HttpHost* host, HttpSessionConfig* config, uint64_t now)
+/*
+ * Put host with deferred requests where it waits for its limits.
+ */
+{
+    if (config->max_host_transfers && host->active_transfers >= config->max_host_transfers) {
+        // woken up by http_host_finished
+        host->state = HTTP_HOST_WAIT_SLOT;
+        return;
+    }
+    if (config->host_rate > 0.0) {
+        refill_tokens(host, config, now);
+        if (host->tokens < 1.0) {
+            host->due_time = now + (uint64_t) ((1.0 - host->tokens) * 1000000.0 / config->host_rate) + 1;
+            wheel_insert(hosts, host, now);
+            return;
+        }
+    }
+    make_ready(hosts, host);
+}
+
+bool http_host_defer(HttpHostScheduler* hosts, HttpHost* host, UwValuePtr request, HttpSessionConfig* config)
+{
+    if (!http_value_queue_push(&host->deferred, request)) {
+        return false;
+    }
+    hosts->deferred++;
+    if (host->state == HTTP_HOST_IDLE) {
+        wait_host(hosts, host, config, monotonic_time());
+    }
+    return true;
+}
+
+void http_host_finished(HttpHostScheduler* hosts, HttpHost* host, HttpSessionConfig* config)
+{
+    if (host->active_transfers) {
+        host->active_transfers--;
+    }
+    if (host->state == HTTP_HOST_WAIT_SLOT) {
+        wait_host(hosts, host, config, monotonic_time());
+    }
+}
+
+UwResult http_host_take_ready(HttpHostScheduler* hosts, HttpSessionConfig* config)
+{
+    uint64_t now = monotonic_time();
+
+    while (hosts->ready_head) {
+        HttpHost* host = hosts->ready_head;
+        if (!can_start(host, config, now) || host->deferred.count == 0) {
+            hosts->ready_head = host->next;
+            if (!hosts->ready_head) {
+                hosts->ready_tail = nullptr;
+            }
+            if (host->deferred.count) {
+                wait_host(hosts, host, config, now);
+            } else {
+                host->state = HTTP_HOST_IDLE;
+            }
+            continue;
+        }
+        hosts->deferred--;
+        UwValue request = http_value_queue_pop(&host->deferred);
+        if (host->deferred.count == 0) {
+            hosts->ready_head = host->next;
+            if (!hosts->ready_head) {
+                hosts->ready_tail = nullptr;
+            }
+            host->state = HTTP_HOST_IDLE;
+        }
+        return uw_move(&request);
+    }
+    return UwNull();
+}
+
+void http_host_advance_wheel(HttpHostScheduler* hosts, HttpSessionConfig* config)
+{
+    if (hosts->wheel_count == 0) {
+        return;
+    }
+    uint64_t now = monotonic_time();
+    uint64_t now_tick = time_to_tick(now);
+    uint64_t num_ticks = now_tick - hosts->wheel_tick;
+    if (num_ticks > HTTP_HOST_WHEEL_SLOTS) {
+        num_ticks = HTTP_HOST_WHEEL_SLOTS;
+    }
+    HttpHost* expired = nullptr;
+    for (uint64_t i = 1; i <= num_ticks; i++) {
+        unsigned slot = (hosts->wheel_tick + i) & (HTTP_HOST_WHEEL_SLOTS - 1);
+        HttpHost* host = hosts->wheel[slot];
+        hosts->wheel[slot] = nullptr;
+        while (host) {
+            HttpHost* next = host->next;
+            host->next = expired;
+            expired = host;
+            hosts->wheel_count--;
+            host = next;
+        }
+    }
+    hosts->wheel_tick = now_tick;
+
+    while (expired) {
+        HttpHost* host = expired;
+        expired = host->next;
+        if (host->due_time > now) {
+            wheel_insert(hosts, host, now);
+        } else {
+            wait_host(hosts, host, config, now);
+        }
+    }
+}
+
+int http_host_wheel_timeout(HttpHostScheduler* hosts)
+{
+    if (hosts->wheel_count == 0) {
+        return -1;
+    }
+    uint64_t now = monotonic_time();
+    for (uint64_t i = 1; i <= HTTP_HOST_WHEEL_SLOTS; i++) {
+        uint64_t tick = hosts->wheel_tick + i;
+        if (hosts->wheel[tick & (HTTP_HOST_WHEEL_SLOTS - 1)]) {
+            uint64_t t = tick * HTTP_HOST_WHEEL_TICK * 1000;
+            return (t > now)? (int) ((t - now + 999) / 1000) : 0;
+        }
+    }
+    return -1;
+}
+
+void http_host_scheduler_fini(HttpHostScheduler* hosts)
+{
+    for (unsigned i = 0; i < hosts->capacity; i++) {
+        HttpHost* host = hosts->table[i];
+        if (host) {
+            http_value_queue_fini(&host->deferred);
+            _uw_default_allocator.free(host, sizeof(HttpHost) + strlen(host->origin) + 1);
+        }
+    }
+    if (hosts->table) {
+        _uw_default_allocator.free(hosts->table, hosts->capacity * sizeof(HttpHost*));
+    }
+    *hosts = (HttpHostScheduler) {};
+}
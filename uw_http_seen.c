@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Set of seen URL fingerprints
+ */
+
+static inline size_t table_size(uint64_t capacity)
+{
+    return sizeof(HttpSeenTable) + capacity * sizeof(uint64_t);
+}
+
+static inline uint64_t slot_value(uint64_t fingerprint)
+/*
+ * Zero marks empty slots.
+ */
+{
+    return fingerprint? fingerprint : 1;
+}
+
+static bool insert(HttpSeenTable* table, uint64_t value)
+/*
+ * Linear probing. Return false if value is already in the table.
+ */
+{
+    uint64_t mask = table->capacity - 1;
+    uint64_t i = value & mask;
+    while (table->slots[i]) {
+        if (table->slots[i] == value) {
+            return false;
+        }
+        i = (i + 1) & mask;
+    }
+    table->slots[i] = value;
+    table->count++;
+    return true;
+}
+
+static void init_table(HttpSeenTable* table, uint64_t capacity)
+{
+    table->magic    = HTTP_SEEN_SET_MAGIC;
+    table->capacity = capacity;
+    table->count    = 0;
+    memset(table->slots, 0, capacity * sizeof(uint64_t));
+}
+
+static void rehash(HttpSeenTable* table, uint64_t* slots, uint64_t capacity)
+{
+    for (uint64_t i = 0; i < capacity; i++) {
+        if (slots[i]) {
+            insert(table, slots[i]);
+        }
+    }
+}
+
+static bool grow_in_memory(HttpSeenSet* set)
+{
+    HttpSeenTable* old_table = set->table;
+    uint64_t new_capacity = old_table->capacity * 2;
+
+    HttpSeenTable* new_table = _uw_default_allocator.alloc(table_size(new_capacity));
+    if (!new_table) {
+        return false;
+    }
+    init_table(new_table, new_capacity);
+    rehash(new_table, old_table->slots, old_table->capacity);
+
+    _uw_default_allocator.free(old_table, set->size);
+    set->table = new_table;
+    set->size = table_size(new_capacity);
+    return true;
+}
+
+static bool grow_mapped(HttpSeenSet* set)
+/*
+ * Build the grown table in a temporary file and rename it over the old one,
+ * so a crash leaves either the old table or the new one, never a partly rehashed.
+ */
+{
+    uint64_t new_capacity = set->table->capacity * 2;
+    size_t new_size = table_size(new_capacity);
+
+    size_t path_length = strlen(set->path);
+    size_t tmp_path_size = path_length + sizeof(".tmp");
+    char* tmp_path = _uw_default_allocator.alloc(tmp_path_size);
+    if (!tmp_path) {
+        return false;
+    }
+    memcpy(tmp_path, set->path, path_length);
+    memcpy(tmp_path + path_length, ".tmp", sizeof(".tmp"));
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR %s: cannot open %s: %s\n", __func__, tmp_path, strerror(errno));
+        _uw_default_allocator.free(tmp_path, tmp_path_size);
+        return false;
+    }
+    // allocate blocks, writing to a hole of sparse file raises SIGBUS when disk is full
+    int err = posix_fallocate(fd, 0, new_size);
+    void* map = MAP_FAILED;
+    if (err == 0) {
+        map = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            err = errno;
+        }
+    }
+    if (map != MAP_FAILED) {
+        HttpSeenTable* new_table = (HttpSeenTable*) map;
+        init_table(new_table, new_capacity);
+        rehash(new_table, set->table->slots, set->table->capacity);
+
+        // the data must reach the disk before the file replaces the old one
+        if (msync(map, new_size, MS_SYNC) == -1 || rename(tmp_path, set->path) == -1) {
+            err = errno;
+            munmap(map, new_size);
+        }
+    }
+    if (err) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, tmp_path, strerror(err));
+        close(fd);
+        unlink(tmp_path);
+        _uw_default_allocator.free(tmp_path, tmp_path_size);
+        return false;
+    }
+    _uw_default_allocator.free(tmp_path, tmp_path_size);
+
+    munmap(set->table, set->size);
+    close(set->fd);
+    set->table = (HttpSeenTable*) map;
+    set->size  = new_size;
+    set->fd    = fd;
+    return true;
+}
+
+static bool open_mapped(HttpSeenSet* set, char* path, uint64_t capacity)
+/*
+ * Map existing table or create a new one.
+ */
+{
+    set->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (set->fd == -1) {
+        fprintf(stderr, "ERROR %s: cannot open %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(set->fd, &st) == -1) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    bool existing = st.st_size != 0;
+    if (existing) {
+        // read the header to get the capacity
+        HttpSeenTable header;
+        if (pread(set->fd, &header, sizeof(header), 0) != sizeof(header)
+            || header.magic != HTTP_SEEN_SET_MAGIC
+            || header.capacity == 0 || (header.capacity & (header.capacity - 1))
+            || (off_t) table_size(header.capacity) != st.st_size) {
+
+            fprintf(stderr, "ERROR %s: %s is not a seen set\n", __func__, path);
+            return false;
+        }
+        capacity = header.capacity;
+    } else {
+        int err = posix_fallocate(set->fd, 0, table_size(capacity));
+        if (err) {
+            fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(err));
+            return false;
+        }
+    }
+    set->size = table_size(capacity);
+    void* map = mmap(nullptr, set->size, PROT_READ | PROT_WRITE, MAP_SHARED, set->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    set->table = (HttpSeenTable*) map;
+    if (!existing) {
+        init_table(set->table, capacity);
+    }
+    return true;
+}
+
+HttpSeenSet* http_create_seen_set(uint64_t capacity, char* path)
+{
+    HttpSeenSet* set = _uw_default_allocator.alloc(sizeof(HttpSeenSet));
+    if (!set) {
+        return nullptr;
+    }
+    *set = (HttpSeenSet) { .fd = -1 };
+
+    // round up to a power of two, n *= 2 would overflow beyond the limit
+    if (capacity > HTTP_SEEN_SET_MAX_CAPACITY) {
+        capacity = HTTP_SEEN_SET_MAX_CAPACITY;
+    }
+    uint64_t n = 64;
+    while (n < capacity) {
+        n *= 2;
+    }
+    if (path) {
+        size_t path_size = strlen(path) + 1;
+        set->path = _uw_default_allocator.alloc(path_size);
+        if (!set->path) {
+            http_delete_seen_set(set);
+            return nullptr;
+        }
+        memcpy(set->path, path, path_size);
+
+        if (!open_mapped(set, path, n)) {
+            http_delete_seen_set(set);
+            return nullptr;
+        }
+    } else {
+        set->size = table_size(n);
+        set->table = _uw_default_allocator.alloc(set->size);
+        if (!set->table) {
+            http_delete_seen_set(set);
+            return nullptr;
+        }
+        init_table(set->table, n);
+    }
+    return set;
+}
+
+void http_delete_seen_set(HttpSeenSet* set)
+{
+    if (set->table) {
+        if (set->fd == -1) {
+            _uw_default_allocator.free(set->table, set->size);
+        } else {
+            munmap(set->table, set->size);
+        }
+    }
+    if (set->fd != -1) {
+        close(set->fd);
+    }
+    if (set->path) {
+        _uw_default_allocator.free(set->path, strlen(set->path) + 1);
+    }
+    _uw_default_allocator.free(set, sizeof(HttpSeenSet));
+}
+
+bool http_seen_set_contains(HttpSeenSet* set, uint64_t fingerprint)
+{
+    HttpSeenTable* table = set->table;
+    uint64_t value = slot_value(fingerprint);
+    uint64_t mask = table->capacity - 1;
+    uint64_t i = value & mask;
+    while (table->slots[i]) {
+        if (table->slots[i] == value) {
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+    return false;
+}
+
+bool http_seen_set_add(HttpSeenSet* set, uint64_t fingerprint, bool* seen)
+{
+    HttpSeenTable* table = set->table;
+
+    // keep load factor below 3/4, probe sequences get long beyond that
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        bool grown = false;
+        if (table->capacity < HTTP_SEEN_SET_MAX_CAPACITY) {
+            grown = (set->fd == -1)? grow_in_memory(set) : grow_mapped(set);
+        }
+        if (!grown && table->count + 1 == table->capacity) {
+            // the last empty slot terminates probe sequences
+            return false;
+        }
+    }
+    *seen = !insert(set->table, slot_value(fingerprint));
+    return true;
+}
+
+bool http_seen_set_add_url(HttpSeenSet* set, UwValuePtr url, bool* seen)
+{
+    uint64_t fingerprint;
+    if (!url_fingerprint(url, &fingerprint)) {
+        // malformed URLs are not worth fetching
+        *seen = true;
+        return true;
+    }
+    return http_seen_set_add(set, fingerprint, seen);
+}
+
+uint64_t http_seen_set_count(HttpSeenSet* set)
+{
+    return set->table->count;
+}
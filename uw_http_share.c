@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Shared DNS, TLS session, and connection cache
+ */
+
+static void lock_callback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+    HttpSharedCache* cache = (HttpSharedCache*) userptr;
+    pthread_mutex_lock(&cache->locks[data]);
+}
+
+static void unlock_callback(CURL* handle, curl_lock_data data, void* userptr)
+{
+    HttpSharedCache* cache = (HttpSharedCache*) userptr;
+    pthread_mutex_unlock(&cache->locks[data]);
+}
+
+HttpSharedCache* http_create_shared_cache(bool share_connections)
+{
+    HttpSharedCache* cache = _uw_default_allocator.alloc(sizeof(HttpSharedCache));
+    if (!cache) {
+        return nullptr;
+    }
+    *cache = (HttpSharedCache) {};
+
+    for (unsigned i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&cache->locks[i], nullptr);
+    }
+    cache->share = curl_share_init();
+    if (!cache->share) {
+        http_delete_shared_cache(cache);
+        return nullptr;
+    }
+    curl_share_setopt(cache->share, CURLSHOPT_LOCKFUNC, lock_callback);
+    curl_share_setopt(cache->share, CURLSHOPT_UNLOCKFUNC, unlock_callback);
+    curl_share_setopt(cache->share, CURLSHOPT_USERDATA, cache);
+
+    CURLSHcode err = curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    if (!err) {
+        err = curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+#   if LIBCURL_VERSION_NUM >= 0x073900
+        if (!err && share_connections) {
+            err = curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        }
+#   endif
+    if (err) {
+        fprintf(stderr, "ERROR %s: %s\n", __func__, curl_share_strerror(err));
+        http_delete_shared_cache(cache);
+        return nullptr;
+    }
+    return cache;
+}
+
+bool http_delete_shared_cache(HttpSharedCache* cache)
+{
+    if (cache->share) {
+        CURLSHcode err = curl_share_cleanup(cache->share);
+        if (err) {
+            // the share still points to this cache, keep it alive
+            fprintf(stderr, "ERROR %s: %s\n", __func__, curl_share_strerror(err));
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&cache->locks[i]);
+    }
+    _uw_default_allocator.free(cache, sizeof(HttpSharedCache));
+    return true;
+}
+
+static bool is_ip_literal(CURL* easy_handle)
+/*
+ * Check if the host of the last connection was given as IP address,
+ * no name lookup is made for such hosts.
+ */
+{
+    char* url = nullptr;
+    char* primary_ip = nullptr;
+    curl_easy_getinfo(easy_handle, CURLINFO_EFFECTIVE_URL, &url);
+    curl_easy_getinfo(easy_handle, CURLINFO_PRIMARY_IP, &primary_ip);
+    if (!url || !primary_ip) {
+        return false;
+    }
+    CURLU* cu = curl_url();
+    if (!cu) {
+        return false;
+    }
+    bool result = false;
+    char* host = nullptr;
+    if (curl_url_set(cu, CURLUPART_URL, url, 0) == CURLUE_OK
+        && curl_url_get(cu, CURLUPART_HOST, &host, 0) == CURLUE_OK) {
+
+        char* addr = host;
+        size_t len = strlen(host);
+        if (len > 2 && host[0] == '[') {
+            addr++;
+            len -= 2;
+        }
+        result = strlen(primary_ip) == len && strncasecmp(addr, primary_ip, len) == 0;
+        curl_free(host);
+    }
+    curl_url_cleanup(cu);
+    return result;
+}
+
+void http_shared_cache_update_stats(HttpSharedCache* cache, CURL* easy_handle)
+{
+    long num_connects = 0;
+    curl_easy_getinfo(easy_handle, CURLINFO_NUM_CONNECTS, &num_connects);
+
+    atomic_fetch_add_explicit(&cache->transfers, 1, memory_order_relaxed);
+
+    if (num_connects == 0) {
+        atomic_fetch_add_explicit(&cache->reused_connections, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&cache->new_connections, 1, memory_order_relaxed);
+
+    char* scheme = nullptr;
+    curl_easy_getinfo(easy_handle, CURLINFO_SCHEME, &scheme);
+    if (scheme && strcasecmp(scheme, "https") == 0) {
+        atomic_fetch_add_explicit(&cache->tls_handshakes, 1, memory_order_relaxed);
+    }
+    curl_off_t namelookup_time = 0;
+    curl_easy_getinfo(easy_handle, CURLINFO_NAMELOOKUP_TIME_T, &namelookup_time);
+    if (namelookup_time < HTTP_DNS_CACHE_HIT_TIME && !is_ip_literal(easy_handle)) {
+        atomic_fetch_add_explicit(&cache->dns_cache_hits, 1, memory_order_relaxed);
+    }
+}
+
+void http_shared_cache_get_stats(HttpSharedCache* cache, HttpSharedCacheStats* stats)
+{
+    stats->transfers          = atomic_load_explicit(&cache->transfers, memory_order_relaxed);
+    stats->new_connections    = atomic_load_explicit(&cache->new_connections, memory_order_relaxed);
+    stats->reused_connections = atomic_load_explicit(&cache->reused_connections, memory_order_relaxed);
+    stats->dns_cache_hits     = atomic_load_explicit(&cache->dns_cache_hits, memory_order_relaxed);
+    stats->tls_handshakes     = atomic_load_explicit(&cache->tls_handshakes, memory_order_relaxed);
+}
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Chunk chains
+ */
+
+static _Thread_local HttpChunkBlock* free_blocks = nullptr;
+static _Thread_local unsigned num_free_blocks = 0;
+
+static HttpChunkBlock* alloc_block()
+{
+    HttpChunkBlock* block = free_blocks;
+    if (block) {
+        free_blocks = block->next;
+        num_free_blocks--;
+    } else {
+        block = _uw_default_allocator.alloc(sizeof(HttpChunkBlock));
+        if (!block) {
+            return nullptr;
+        }
+    }
+    block->next = nullptr;
+    block->used = 0;
+    return block;
+}
+
+static void free_block(HttpChunkBlock* block)
+{
+    if (num_free_blocks < HTTP_CHUNK_POOL_MAX_BLOCKS) {
+        block->next = free_blocks;
+        free_blocks = block;
+        num_free_blocks++;
+    } else {
+        _uw_default_allocator.free(block, sizeof(HttpChunkBlock));
+    }
+}
+
+void http_chunk_pool_trim()
+{
+    while (free_blocks) {
+        HttpChunkBlock* next = free_blocks->next;
+        _uw_default_allocator.free(free_blocks, sizeof(HttpChunkBlock));
+        free_blocks = next;
+    }
+    num_free_blocks = 0;
+}
+
+bool http_chunk_chain_append(HttpChunkChain* chain, uint8_t* data, size_t size)
+{
+    while (size) {
+        HttpChunkBlock* block = chain->last;
+        if (!block || block->used == HTTP_CHUNK_BLOCK_SIZE) {
+            block = alloc_block();
+            if (!block) {
+                return false;
+            }
+            if (chain->last) {
+                chain->last->next = block;
+            } else {
+                chain->first = block;
+            }
+            chain->last = block;
+        }
+        size_t room = HTTP_CHUNK_BLOCK_SIZE - block->used;
+        size_t n = (size < room)? size : room;
+        memcpy(block->data + block->used, data, n);
+        block->used += n;
+        chain->length += n;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void http_chunk_chain_free(HttpChunkChain* chain)
+{
+    HttpChunkBlock* block = chain->first;
+    while (block) {
+        HttpChunkBlock* next = block->next;
+        free_block(block);
+        block = next;
+    }
+    *chain = (HttpChunkChain) {};
+}
+
+bool http_chunk_chain_foreach(HttpChunkChain* chain, HttpSegmentVisitor visitor, void* arg)
+{
+    for (HttpChunkBlock* block = chain->first; block; block = block->next) {
+        if (!visitor(block->data, block->used, arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+UwResult http_chunk_chain_flatten(HttpChunkChain* chain)
+{
+    UwValue result = uw_create_empty_string(chain->length, 1);
+    if (uw_error(&result)) {
+        return uw_move(&result);
+    }
+    for (HttpChunkBlock* block = chain->first; block; block = block->next) {
+        if (!uw_string_append_buffer(&result, block->data, block->used)) {
+            return UwOOM();
+        }
+    }
+    http_chunk_chain_free(chain);
+    return uw_move(&result);
+}
+
+void http_request_set_segmented_content(UwValuePtr request, bool segmented)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    req->segmented_content = segmented;
+}
+
+void http_request_set_raw_content(UwValuePtr request, bool raw)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    req->raw_content = raw;
+}
+
+void http_request_set_decode_charset(UwValuePtr request, bool decode)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    req->decode_charset = decode;
+}
+
+UwResult http_request_flatten_content(HttpRequestData* req)
+{
+    if (req->chunks.first) {
+        UwValue content = http_chunk_chain_flatten(&req->chunks);
+        if (uw_error(&content)) {
+            return uw_move(&content);
+        }
+        uw_destroy(&req->content);
+        req->content = uw_move(&content);
+    }
+    return uw_clone(&req->content);
+}
+
+/****************************************************************
+ * Body sinks
+ */
+
+bool http_request_set_sink_fd(UwValuePtr request, int fd, bool preallocate)
+{
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    http_sink_close(req, false);
+
+    req->sink = (HttpBodySink) {
+        .type        = HTTP_SINK_FD,
+        .fd          = fd,
+        .preallocate = preallocate
+    };
+    return true;
+}
+
+bool http_request_set_sink_file(UwValuePtr request, char* path)
+{
+    // no O_TRUNC, existing data is kept for resumed downloads;
+    // O_RDWR is required for mmap
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR %s: cannot open %s: %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+    HttpRequestData* req = (HttpRequestData*) request->extra_data;
+
+    http_request_set_sink_fd(request, fd, true);
+    req->sink.own_fd = true;
+    return true;
+}
+
+static bool map_file(HttpBodySink* sink, curl_off_t content_length)
+/*
+ * Preallocate file space for the body and map it into memory.
+ * Return false if not possible, the caller falls back to pwrite.
+ */
+{
+    off_t end = sink->offset + content_length;
+
+    // blocks must be allocated, writing to a hole of sparse file raises SIGBUS when disk is full;
+    // posix_fallocate falls back to writing blocks if the file system does not support fallocate
+    if (posix_fallocate(sink->fd, sink->offset, content_length) != 0) {
+        return false;
+    }
+    // mmap offset must be page-aligned
+    off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t map_offset = sink->offset & ~(page_size - 1);
+    size_t map_size = end - map_offset;
+
+    void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, map_offset);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    sink->map        = (uint8_t*) map;
+    sink->map_size   = map_size;
+    sink->map_offset = map_offset;
+    sink->map_end    = end;
+    return true;
+}
+
+static long response_status(HttpRequestData* req)
+{
+    long status = 0;
+    if (req->easy_handle) {
+        curl_easy_getinfo(req->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+    }
+    return status;
+}
+
+static inline bool is_2xx(long status)
+{
+    return 200 <= status && status <= 299;
+}
+
+bool http_sink_open(HttpRequestData* req)
+{
+    HttpBodySink* sink = &req->sink;
+
+    curl_off_t content_length;
+    CURLcode res = curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+    if (res != CURLE_OK || content_length < 0) {
+        content_length = 0;
+    }
+
+    switch (sink->type) {
+        case HTTP_SINK_MEMORY:
+            if (content_length == 0 || req->cache_store || req->raw_content) {
+                // unknown length, collect chunks instead of growing the string;
+                // the disk cache stores the body from chunks and raw content is decoded from them
+                break;
+            }
+            req->content = uw_create_empty_string(content_length, 1);
+            if (uw_error(&req->content)) {
+                return false;
+            }
+            break;
+
+        case HTTP_SINK_FD:
+        case HTTP_SINK_MMAP: {
+            long status = response_status(req);
+            sink->type = HTTP_SINK_FD;
+            if (!is_2xx(status)) {
+                // e.g. 404 page must not end up in the middle of resumed download
+                sink->offset = (off_t) req->resume_pos;
+                sink->discard = true;
+                break;
+            }
+            // resumed download continues at the end of existing data,
+            // unless the server ignored the range and sends the whole body
+            sink->offset = (status == 206)? (off_t) req->resume_pos : 0;
+            if (sink->preallocate && content_length > 0) {
+                if (map_file(sink, content_length)) {
+                    sink->type = HTTP_SINK_MMAP;
+                }
+            }
+            break;
+        }
+    }
+    sink->opened = true;
+    return true;
+}
+
+static bool write_fd(HttpBodySink* sink, uint8_t* data, size_t size)
+{
+    while (size) {
+        ssize_t n = pwrite(sink->fd, data, size, sink->offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(__func__);
+            return false;
+        }
+        data += n;
+        size -= n;
+        sink->offset += n;
+    }
+    return true;
+}
+
+size_t http_sink_write(HttpRequestData* req, uint8_t* data, size_t size)
+{
+    HttpBodySink* sink = &req->sink;
+
+    if (sink->discard) {
+        return size;
+    }
+
+    switch (sink->type) {
+        case HTTP_SINK_MEMORY:
+            if (uw_is_null(&req->content)) {
+                if (!http_chunk_chain_append(&req->chunks, data, size)) {
+                    return 0;
+                }
+            } else if (!uw_string_append_buffer(&req->content, data, size)) {
+                return 0;
+            }
+            return size;
+
+        case HTTP_SINK_MMAP: {
+            // Content-Length is the length of encoded data,
+            // decoded body may not fit the mapping and the rest goes to pwrite
+            size_t room = sink->map_end - sink->offset;
+            size_t n = (size < room)? size : room;
+            memcpy(sink->map + (sink->offset - sink->map_offset), data, n);
+            sink->offset += n;
+            if (n == size) {
+                return size;
+            }
+            if (!write_fd(sink, data + n, size - n)) {
+                return 0;
+            }
+            return size;
+        }
+
+        case HTTP_SINK_FD:
+            if (!write_fd(sink, data, size)) {
+                return 0;
+            }
+            return size;
+    }
+    return 0;
+}
+
+void http_sink_close(HttpRequestData* req, bool success)
+{
+    HttpBodySink* sink = &req->sink;
+
+    // the rest of converted text goes first
+    http_charset_close(req, success);
+
+    if (sink->map) {
+        munmap(sink->map, sink->map_size);
+        sink->map = nullptr;
+        sink->map_size = 0;
+    }
+    if (sink->fd != -1 && sink->type != HTTP_SINK_MEMORY) {
+        // drop preallocated space and stale data beyond the body,
+        // but only if the file received 2xx body, possibly empty one
+        bool truncate = false;
+        off_t end = sink->offset;
+        if (sink->opened) {
+            truncate = !sink->discard;
+        } else if (success) {
+            long status = response_status(req);
+            truncate = is_2xx(status);
+            end = (status == 206)? (off_t) req->resume_pos : 0;
+        }
+        if (truncate && ftruncate(sink->fd, end) == -1) {
+            perror(__func__);
+        }
+        if (sink->own_fd) {
+            close(sink->fd);
+        }
+        sink->fd = -1;
+        sink->own_fd = false;
+    }
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Request timing and latency histograms
+ */
+
+void http_request_update_timing(HttpRequestData* req)
+{
+    HttpRequestTiming* t = &req->timing;
+    CURL* h = req->easy_handle;
+
+    curl_easy_getinfo(h, CURLINFO_NAMELOOKUP_TIME_T,    &t->namelookup);
+    curl_easy_getinfo(h, CURLINFO_CONNECT_TIME_T,       &t->connect);
+    curl_easy_getinfo(h, CURLINFO_APPCONNECT_TIME_T,    &t->appconnect);
+    curl_easy_getinfo(h, CURLINFO_PRETRANSFER_TIME_T,   &t->pretransfer);
+    curl_easy_getinfo(h, CURLINFO_STARTTRANSFER_TIME_T, &t->starttransfer);
+    curl_easy_getinfo(h, CURLINFO_TOTAL_TIME_T,         &t->total);
+    curl_easy_getinfo(h, CURLINFO_REDIRECT_TIME_T,      &t->redirect);
+    curl_easy_getinfo(h, CURLINFO_SIZE_DOWNLOAD_T,      &t->size_download);
+    curl_easy_getinfo(h, CURLINFO_SIZE_UPLOAD_T,        &t->size_upload);
+    curl_easy_getinfo(h, CURLINFO_HEADER_SIZE,          &t->header_size);
+    curl_easy_getinfo(h, CURLINFO_REQUEST_SIZE,         &t->request_size);
+    curl_easy_getinfo(h, CURLINFO_REDIRECT_COUNT,       &t->redirect_count);
+}
+
+static inline uint64_t elapsed(curl_off_t start, curl_off_t end)
+{
+    return (end > start)? (uint64_t) (end - start) : 0;
+}
+
+static unsigned histogram_index(uint64_t value)
+{
+    if (value < HTTP_HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned) value;
+    }
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned group = msb - HTTP_HISTOGRAM_SUB_BITS + 1;
+    unsigned sub = (unsigned) (value >> (msb - HTTP_HISTOGRAM_SUB_BITS)) - HTTP_HISTOGRAM_SUB_BUCKETS;
+    unsigned index = group * HTTP_HISTOGRAM_SUB_BUCKETS + sub;
+    return (index < HTTP_HISTOGRAM_BUCKETS)? index : HTTP_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t histogram_bucket_upper_bound(unsigned index)
+/*
+ * Return the highest value that falls into the bucket.
+ */
+{
+    if (index < HTTP_HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    unsigned group = index / HTTP_HISTOGRAM_SUB_BUCKETS;
+    unsigned sub   = index % HTTP_HISTOGRAM_SUB_BUCKETS;
+    unsigned shift = group - 1;
+    uint64_t lower = ((uint64_t) (HTTP_HISTOGRAM_SUB_BUCKETS + sub)) << shift;
+    return lower + (((uint64_t) 1) << shift) - 1;
+}
+
+void http_histogram_record(HttpLatencyHistogram* hist, uint64_t value)
+/*
+ * There's a single writer, the session, so plain loads and stores
+ * of atomic variables are enough for readers to get consistent numbers.
+ */
+{
+    _Atomic uint64_t* bucket = &hist->buckets[histogram_index(value)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum, atomic_load_explicit(&hist->sum, memory_order_relaxed) + value, memory_order_relaxed);
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+    }
+    atomic_store_explicit(&hist->count, atomic_load_explicit(&hist->count, memory_order_relaxed) + 1, memory_order_release);
+}
+
+void http_histogram_snapshot(HttpLatencyHistogram* hist, HttpLatencyHistogram* snapshot)
+{
+    atomic_store_explicit(&snapshot->count, atomic_load_explicit(&hist->count, memory_order_acquire), memory_order_relaxed);
+    atomic_store_explicit(&snapshot->sum, atomic_load_explicit(&hist->sum, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&snapshot->max, atomic_load_explicit(&hist->max, memory_order_relaxed), memory_order_relaxed);
+    for (unsigned i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&snapshot->buckets[i],
+                              atomic_load_explicit(&hist->buckets[i], memory_order_relaxed), memory_order_relaxed);
+    }
+}
+
+void http_histogram_reset(HttpLatencyHistogram* hist)
+{
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+    for (unsigned i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+uint64_t http_histogram_percentile(HttpLatencyHistogram* hist, double percentile)
+{
+    // buckets may be updated while we're counting, use their own total
+    uint64_t total = 0;
+    for (unsigned i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+        total += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (percentile / 100.0 * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t value = histogram_bucket_upper_bound(i);
+            uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+            return (value < max)? value : max;
+        }
+    }
+    return atomic_load_explicit(&hist->max, memory_order_relaxed);
+}
+
+void http_session_record_timing(void* session, HttpRequestData* req)
+{
+    HttpLatencyHistogram* latency = ((HttpSession*) session)->latency;
+    HttpRequestTiming* t = &req->timing;
+
+    http_histogram_record(&latency[HTTP_PHASE_DNS], (uint64_t) t->namelookup);
+    http_histogram_record(&latency[HTTP_PHASE_CONNECT], elapsed(t->namelookup, t->connect));
+    if (t->appconnect) {
+        http_histogram_record(&latency[HTTP_PHASE_TLS], elapsed(t->connect, t->appconnect));
+    }
+    http_histogram_record(&latency[HTTP_PHASE_TTFB], elapsed(t->pretransfer, t->starttransfer));
+    http_histogram_record(&latency[HTTP_PHASE_TRANSFER], elapsed(t->starttransfer, t->total));
+    http_histogram_record(&latency[HTTP_PHASE_TOTAL], (uint64_t) t->total);
+}
+
+void http_session_latency_snapshot(void* session, HttpLatencyHistogram snapshot[HTTP_NUM_PHASES])
+{
+    HttpLatencyHistogram* latency = ((HttpSession*) session)->latency;
+
+    for (unsigned i = 0; i < HTTP_NUM_PHASES; i++) {
+        http_histogram_snapshot(&latency[i], &snapshot[i]);
+    }
+}
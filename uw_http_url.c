@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <uw.h>
+
+#include "uw_http.h"
+
+/****************************************************************
+ * Pre-parsed base URL
+ */
+
+UwTypeId UwTypeId_UrlBase = 0;
+
+static UwType url_base_type;
+
+static void fini_url_base(UwValuePtr self)
+/*
+ * Basic UW interface method
+ */
+{
+    UrlBaseData* base = (UrlBaseData*) self->extra_data;
+
+    if (base->url) {
+        curl_free(base->url);
+        base->url = nullptr;
+    }
+    if (base->handle) {
+        curl_url_cleanup(base->handle);
+        base->handle = nullptr;
+    }
+}
+
+static UwResult init_url_base(UwValuePtr self, va_list ap)
+/*
+ * Basic UW interface method
+ * The URL is parsed by url_base_create_cstr.
+ */
+{
+    return UwOK();
+}
+
+void init_url_base_type()
+{
+    UwTypeId_UrlBase = uw_subtype(
+        &url_base_type, "UrlBase",
+        UwTypeId_Struct, sizeof(UrlBaseData)
+    );
+    if (UwTypeId_UrlBase == UwTypeId_Null) {
+        fprintf(stderr, "Failed creating URL base subtype\n");
+        exit(1);
+    }
+    url_base_type._init = init_url_base;
+    url_base_type._fini = fini_url_base;
+}
+
+static void locate_parts(UrlBaseData* base)
+/*
+ * Find boundaries of normalized base URL for fast paths.
+ */
+{
+    char* url = base->url;
+    char* fragment = strchr(url, '#');
+    base->fragment_start = fragment? (size_t) (fragment - url) : strlen(url);
+
+    char* authority = strstr(url, "://");
+    if (!authority) {
+        return;
+    }
+    base->scheme_length = authority - url;
+
+    // CURL always adds a path to hierarchical URLs
+    char* path = strchr(authority + 3, '/');
+    if (path) {
+        base->origin_length = path - url;
+    }
+    base->is_http = (base->scheme_length == 4 && memcmp(url, "http", 4) == 0)
+                    || (base->scheme_length == 5 && memcmp(url, "https", 5) == 0);
+}
+
+UwResult url_base_create_cstr(char* base_url)
+{
+    UwValue result = _uw_create(UwTypeId_UrlBase);
+    if (uw_error(&result)) {
+        return uw_move(&result);
+    }
+    UrlBaseData* base = (UrlBaseData*) result.extra_data;
+
+    base->handle = curl_url();
+    if (!base->handle) {
+        return UwOOM();
+    }
+    CURLUcode rc = curl_url_set(base->handle, CURLUPART_URL, base_url, 0);
+    if (rc == CURLUE_OK) {
+        rc = curl_url_get(base->handle, CURLUPART_URL, &base->url, 0);
+    }
+    if (rc == CURLUE_OUT_OF_MEMORY) {
+        return UwOOM();
+    }
+    if (rc) {
+        fprintf(stderr, "ERROR %s: %s: %s\n", __func__, base_url, curl_url_strerror(rc));
+        return UwNull();
+    }
+    locate_parts(base);
+    return uw_move(&result);
+}
+
+UwResult url_base_create(UwValuePtr base_url)
+{
+    UW_CSTRING_LOCAL(cstr_base_url, base_url);
+    return url_base_create_cstr(cstr_base_url);
+}
+
+static inline bool is_plain_char(unsigned char c)
+/*
+ * Characters CURL leaves as is.
+ * Spaces and non-ASCII characters are percent-encoded, control characters are rejected.
+ */
+{
+    return c > ' ' && c < 0x7F;
+}
+
+static bool is_plain_reference(char* ptr)
+/*
+ * Check the part of reference starting from path
+ * for anything CURL would normalize: dot segments, empty query and fragment, and
+ * characters that need encoding.
+ */
+{
+    // path
+    char* segment = ptr;
+    for (;;) {
+        char c = *ptr;
+        if (c == '/' || c == '?' || c == '#' || c == 0) {
+            size_t n = ptr - segment;
+            if ((n == 1 && segment[0] == '.') || (n == 2 && segment[0] == '.' && segment[1] == '.')) {
+                return false;
+            }
+            if (c != '/') {
+                break;
+            }
+            segment = ptr + 1;
+        } else if (!is_plain_char(c)) {
+            return false;
+        }
+        ptr++;
+    }
+    // query
+    if (*ptr == '?') {
+        ptr++;
+        if (*ptr == '#' || *ptr == 0) {
+            return false;
+        }
+        while (*ptr != '#' && *ptr != 0) {
+            if (!is_plain_char(*ptr++)) {
+                return false;
+            }
+        }
+    }
+    // fragment
+    if (*ptr == '#') {
+        ptr++;
+        if (*ptr == 0) {
+            return false;
+        }
+        while (*ptr) {
+            if (!is_plain_char(*ptr++)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static inline bool is_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static char* skip_plain_authority(char* ptr)
+/*
+ * Skip host name and port CURL would not normalize.
+ * Return pointer to path or nullptr.
+ *
+ * Host must start with a letter to rule out numeric IPv4 forms.
+ * IPv6 literals, user info, and port numbers with leading zeros
+ * take the slow path.
+ */
+{
+    if (!is_alpha(*ptr)) {
+        return nullptr;
+    }
+    while (is_alpha(*ptr) || is_digit(*ptr) || *ptr == '.' || *ptr == '-') {
+        ptr++;
+    }
+    if (*ptr == ':') {
+        ptr++;
+        char* port = ptr;
+        unsigned value = 0;
+        while (is_digit(*ptr) && ptr - port < 5) {
+            value = value * 10 + (*ptr++ - '0');
+        }
+        size_t n = ptr - port;
+        if (n == 0 || value > 65535 || (port[0] == '0' && n > 1)) {
+            return nullptr;
+        }
+    }
+    return (*ptr == '/')? ptr : nullptr;
+}
+
+static size_t fast_join_prefix(UrlBaseData* base, char* other_url)
+/*
+ * If the result of join is a prefix of base URL followed by other_url,
+ * return the length of that prefix, zero otherwise.
+ * Other schemes have their own quirks in CURL, e.g. file drops the query.
+ */
+{
+    if (!base->is_http || other_url[0] != '/') {
+        return 0;
+    }
+    if (other_url[1] == '/') {
+        // same scheme, other host
+        char* path = skip_plain_authority(other_url + 2);
+        if (path && is_plain_reference(path)) {
+            return base->scheme_length + 1;
+        }
+    } else if (base->origin_length && is_plain_reference(other_url)) {
+        // absolute path
+        return base->origin_length;
+    }
+    return 0;
+}
+
+static UwResult join_fragment(UrlBaseData* base, char* fragment)
+/*
+ * Replace fragment of base URL as RFC 3986 section 5.2.2 prescribes,
+ * keeping path and query. Percent-encode what CURL would encode.
+ */
+{
+    size_t n = strlen(fragment);
+    if (n == 1) {
+        // empty fragment is dropped, the same way CURL does
+        n = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = fragment[i];
+        if (c < ' ' || c == 0x7F) {
+            return UwNull();
+        }
+    }
+    UwValue result = uw_create_empty_string(base->fragment_start + n * 3, 1);
+    if (uw_error(&result)) {
+        return uw_move(&result);
+    }
+    if (!uw_string_append_substring_cstr(&result, base->url, 0, base->fragment_start)) {
+        return UwOOM();
+    }
+    static char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = fragment[i];
+        bool ok;
+        if (c == ' ' || c > 0x7F) {
+            ok = uw_string_append_char(&result, '%')
+                 && uw_string_append_char(&result, hex[c >> 4])
+                 && uw_string_append_char(&result, hex[c & 15]);
+        } else {
+            ok = uw_string_append_char(&result, c);
+        }
+        if (!ok) {
+            return UwOOM();
+        }
+    }
+    return uw_move(&result);
+}
+
+UwResult url_base_join_cstr(UwValuePtr url_base, char* other_url)
+{
+    UrlBaseData* base = (UrlBaseData*) url_base->extra_data;
+
+    if (other_url[0] == '#') {
+        return join_fragment(base, other_url);
+    }
+    size_t prefix = fast_join_prefix(base, other_url);
+    if (prefix) {
+        UwValue result = uw_create_empty_string(prefix + strlen(other_url), 1);
+        if (uw_error(&result)) {
+            return uw_move(&result);
+        }
+        if (!uw_string_append_substring_cstr(&result, base->url, 0, prefix)) {
+            return UwOOM();
+        }
+        if (!uw_string_append(&result, other_url)) {
+            return UwOOM();
+        }
+        return uw_move(&result);
+    }
+
+    // resolve with CURL, starting from a copy of already parsed base
+    CURLU* handle = curl_url_dup(base->handle);
+    if (!handle) {
+        return UwOOM();
+    }
+    char* url = nullptr;
+    CURLUcode rc = curl_url_set(handle, CURLUPART_URL, other_url, 0);
+    if (rc == CURLUE_OK) {
+        rc = curl_url_get(handle, CURLUPART_URL, &url, 0);
+    }
+    curl_url_cleanup(handle);
+    if (rc == CURLUE_OUT_OF_MEMORY) {
+        return UwOOM();
+    }
+    if (rc) {
+        return UwNull();
+    }
+    UwValue result = uw_create_string_cstr(url);
+    curl_free(url);
+    return uw_move(&result);
+}
+
+UwResult url_base_join(UwValuePtr url_base, UwValuePtr other_url)
+{
+    UW_CSTRING_LOCAL(cstr_other_url, other_url);
+    return url_base_join_cstr(url_base, cstr_other_url);
+}
+
+UwResult url_base_join_list(UwValuePtr url_base, UwValuePtr urls)
+{
+    UwValue result = UwList();
+    if (uw_error(&result)) {
+        return uw_move(&result);
+    }
+    size_t n = uw_list_length(urls);
+    for (size_t i = 0; i < n; i++) {
+        UwValue other_url = uw_list_item(urls, i);
+        UwValue joined = UwNull();
+        if (uw_is_string(&other_url)) {
+            joined = url_base_join(url_base, &other_url);
+            if (uw_error(&joined)) {
+                return uw_move(&joined);
+            }
+        }
+        if (!uw_list_append(&result, &joined)) {
+            return UwOOM();
+        }
+    }
+    return uw_move(&result);
+}
+
+/****************************************************************
+ * Canonical URLs and fingerprints
+ */
+
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static inline bool is_unreserved(unsigned char c)
+/*
+ * RFC 3986 section 2.3
+ */
+{
+    return is_alpha(c) || is_digit(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static char* normalize_percent_encoding(char* dest, char* src, bool is_path)
+/*
+ * RFC 3986 section 6.2.2: decode percent-encoded unreserved characters,
+ * use uppercase hex digits for the rest. Encode spaces, control and non-ASCII
+ * characters, and stray percent signs.
+ * Dots are left encoded in paths, they would make new dot segments.
+ * dest must have room for 3 * strlen(src) + 1 characters.
+ */
+{
+    static char hex[] = "0123456789ABCDEF";
+    while (*src) {
+        unsigned char c = *src++;
+        if (c == '%') {
+            int hi = hex_value(src[0]);
+            int lo = (hi < 0)? -1 : hex_value(src[1]);
+            if (lo >= 0) {
+                src += 2;
+                c = (unsigned char) ((hi << 4) | lo);
+                if (is_unreserved(c) && !(c == '.' && is_path)) {
+                    *dest++ = c;
+                    continue;
+                }
+            }
+        } else if (c > ' ' && c < 0x7F) {
+            *dest++ = c;
+            continue;
+        }
+        *dest++ = '%';
+        *dest++ = hex[c >> 4];
+        *dest++ = hex[c & 15];
+    }
+    *dest = 0;
+    return dest;
+}
+
+static bool normalize_part(CURLU* handle, CURLUPart what)
+/*
+ * Replace path or query with normalized one.
+ */
+{
+    char* value;
+    CURLUcode rc = curl_url_get(handle, what, &value, 0);
+    if (rc == CURLUE_NO_QUERY) {
+        return true;
+    }
+    if (rc != CURLUE_OK) {
+        return false;
+    }
+    size_t size = 3 * strlen(value) + 1;
+    char* normalized = _uw_default_allocator.alloc(size);
+    if (normalized) {
+        normalize_percent_encoding(normalized, value, what == CURLUPART_PATH);
+        rc = curl_url_set(handle, what, normalized, 0);
+        _uw_default_allocator.free(normalized, size);
+    }
+    curl_free(value);
+    return normalized && rc == CURLUE_OK;
+}
+
+static bool normalize_authority(CURLU* handle)
+/*
+ * Lowercase host and drop default port. CURL lowercases the scheme itself.
+ */
+{
+    char* host;
+    if (curl_url_get(handle, CURLUPART_HOST, &host, 0) != CURLUE_OK) {
+        return false;
+    }
+    for (char* p = host; *p; p++) {
+        if (*p >= 'A' && *p <= 'Z') {
+            *p += 'a' - 'A';
+        }
+    }
+    CURLUcode rc = curl_url_set(handle, CURLUPART_HOST, host, 0);
+    curl_free(host);
+    if (rc != CURLUE_OK) {
+        return false;
+    }
+    char* port;
+    rc = curl_url_get(handle, CURLUPART_PORT, &port, CURLU_NO_DEFAULT_PORT);
+    if (rc == CURLUE_OK) {
+        curl_free(port);
+        return true;
+    }
+    // no port or the default one
+    return rc == CURLUE_NO_PORT && curl_url_set(handle, CURLUPART_PORT, nullptr, 0) == CURLUE_OK;
+}
+
+static char* canonicalize(char* url)
+/*
+ * Return canonical URL allocated by CURL, nullptr if URL is malformed.
+ */
+{
+    CURLU* handle = curl_url();
+    if (!handle) {
+        return nullptr;
+    }
+    char* result = nullptr;
+    // CURL removes dot segments while parsing
+    if (curl_url_set(handle, CURLUPART_URL, url, CURLU_ALLOW_SPACE) == CURLUE_OK
+        && curl_url_set(handle, CURLUPART_FRAGMENT, nullptr, 0) == CURLUE_OK
+        && normalize_part(handle, CURLUPART_PATH)
+        && normalize_part(handle, CURLUPART_QUERY)
+        && normalize_authority(handle)) {
+
+        if (curl_url_get(handle, CURLUPART_URL, &result, 0) != CURLUE_OK) {
+            result = nullptr;
+        }
+    }
+    // CURL writes percent-encoding in lowercase
+    for (char* p = result; p && *p; p++) {
+        if (*p == '%' && hex_value(p[1]) >= 0 && hex_value(p[2]) >= 0) {
+            for (unsigned i = 1; i <= 2; i++) {
+                if (p[i] >= 'a' && p[i] <= 'f') {
+                    p[i] -= 'a' - 'A';
+                }
+            }
+            p += 2;
+        }
+    }
+    curl_url_cleanup(handle);
+    return result;
+}
+
+UwResult url_canonicalize_cstr(char* url)
+{
+    char* canonical_url = canonicalize(url);
+    if (!canonical_url) {
+        return UwNull();
+    }
+    UwValue result = uw_create_string_cstr(canonical_url);
+    curl_free(canonical_url);
+    return uw_move(&result);
+}
+
+UwResult url_canonicalize(UwValuePtr url)
+{
+    UW_CSTRING_LOCAL(cstr_url, url);
+    return url_canonicalize_cstr(cstr_url);
+}
+
+static uint64_t hash_url(char* url)
+/*
+ * FNV-1a with a final mix, so that low bits are good enough for table indexing.
+ */
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char* p = (unsigned char*) url; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool url_fingerprint_cstr(char* url, uint64_t* fingerprint)
+{
+    char* canonical_url = canonicalize(url);
+    if (!canonical_url) {
+        return false;
+    }
+    *fingerprint = hash_url(canonical_url);
+    curl_free(canonical_url);
+    return true;
+}
+
+bool url_fingerprint(UwValuePtr url, uint64_t* fingerprint)
+{
+    UW_CSTRING_LOCAL(cstr_url, url);
+    return url_fingerprint_cstr(cstr_url, fingerprint);
+}
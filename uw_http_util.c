@@ -1,47 +1,12 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include <uw.h>
 
 #include "uw_http.h"
 
-static char* get_response_header(CURL* easy_handle, char* name)
-/*
- * Return the pointer to an internally allocated memory.
- * The header should be parsed immediately, otherwise subsequent calls to CURL API
- * will clobber it.
- */
-{
-    char* last_value = nullptr;
-    int last_request = 0;
-    int last_amount = 1;
-
-    struct curl_header* hdr;
-
-    // iterate over requests made to get the last header
-    for (int i = 0;; i++) {
-        CURLHcode res = curl_easy_header(easy_handle, name, 0, CURLH_HEADER, i, &hdr);
-        if (res == CURLHE_OK) {
-            last_value = hdr->value;
-            last_amount = hdr->amount;
-            last_request = i;
-        } else {
-            break;
-        }
-    }
-    if (last_value == nullptr) {
-        return nullptr;
-    }
-    // get last instance of header
-    CURLHcode res = curl_easy_header(easy_handle, name, last_amount - 1, CURLH_HEADER, last_request, &hdr);
-    if (res == CURLHE_OK) {
-        return hdr->value;
-    } else {
-        return last_value;
-    }
-}
-
 static inline bool is_ctl(unsigned char c)
 /*
  * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
@@ -50,28 +15,7 @@ static inline bool is_ctl(unsigned char c)
  *       (octets 0 - 31) and DEL (127)>
  */
 {
-    return (0 <= c && c <= 31) || c == 127;
-}
-
-static inline bool is_separator(unsigned char c)
-/*
- * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
- *
- * separators = "(" | ")" | "<" | ">" | "@"
- *            | "," | ";" | ":" | "\" | <">
- *            | "/" | "[" | "]" | "?" | "="
- *            | "{" | "}" | SP  | HT
- */
-{
-    switch (c) {
-        case '(':  case ')':  case '<':  case '>':  case '@':
-        case ',':  case ';':  case ':':  case '\\': case '"':
-        case '/':  case '[':  case ']':  case '?':  case '=':
-        case '{':  case '}':  case ' ':  case '\t':
-            return true;
-        default:
-            return false;
-    }
+    return http_char_class[c] & HTTP_CHAR_CTL;
 }
 
 static inline void skip_lwsp(char** current_char)
@@ -82,48 +26,28 @@ static inline void skip_lwsp(char** current_char)
 {
     // simplified, not strictly follows the grammar
     char* ptr = *current_char;
-    for (;;) {
-        char c = *ptr;
-        if (c == 0) {
-            break;
-        }
-        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
-            break;
-        }
+    while (http_char_class[(unsigned char) *ptr] & HTTP_CHAR_LWSP) {
         ptr++;
     }
     *current_char = ptr;
 }
 
-static UwResult parse_token(char** current_char)
+static HttpSlice parse_token(char** current_char)
 /*
  * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
  *
  * token = 1*<any CHAR except CTLs or separators>
  *
- * Return token as string or error.
+ * Return token, possibly empty.
  */
 {
     char* token_start = *current_char;
-    char* token_end = token_start;
-
-    while (!(is_separator(*token_end) || is_ctl(*token_end))) {
-        token_end++;
-    }
-    UwValue token = uw_create("");
-    if (uw_ok(&token)) {
-        size_t token_length = token_end - token_start;
-        if (token_length) {
-            if (!uw_string_append_substring_cstr(&token, token_start, 0, token_length)) {
-                return UwOOM();
-            }
-        }
-    }
+    char* token_end = http_scan_token(token_start);
     *current_char = token_end;
-    return uw_move(&token);
+    return (HttpSlice) { .ptr = token_start, .length = token_end - token_start };
 }
 
-static UwResult parse_quoted_string(char** current_char)
+static bool parse_quoted_string(char** current_char, HttpArena* arena, HttpSlice* result)
 /*
  * https://datatracker.ietf.org/doc/html/rfc7230#section-3.2.6
  *
@@ -132,60 +56,54 @@ static UwResult parse_quoted_string(char** current_char)
  * obs-text      = %x80-FF
  * quoted-pair   = "\" ( HTAB / SP / VCHAR / obs-text )
  *
- * Return string, null value if not a quoted string, or OOM error.
+ * Set result to the content of quoted string, empty if the string is malformed.
+ * The content is copied to the arena only if it contains quoted pairs.
+ *
+ * Return false if out of memory.
  */
 {
-    char* qstr_start = *current_char;
-
-    UWDECL_String(result);
-
-    if (*qstr_start != '"') {
-        return UwNull();
-    }
-    qstr_start++;
-
+    char* qstr_start = *current_char + 1;  // skip opening quote
     char* qstr_end = qstr_start;
-    size_t qstr_length = 0;
+    bool escaped = false;
     for (;;) {
-        unsigned char c = *qstr_end;
-        if (is_ctl(c)) {
-            if (c != ' ' && c != '\t') {
-                break;
-            }
-        }
-        if (c == '"') {
+        qstr_end = http_scan_qdtext(qstr_end);
+        if (*qstr_end != '\\') {
+            // closing quote, CTL, or end of string
             break;
         }
-        if (c != '\\') {
-            qstr_end++;
-            continue;
-        }
-        // append what we've got and skip quote char
-        qstr_length = qstr_end - qstr_start;
-        if (qstr_length) {
-            if (!uw_string_append_substring_cstr(&result, qstr_start, 0, qstr_length)) {
-                return UwOOM();
-            }
+        unsigned char c = qstr_end[1];
+        if (is_ctl(c) && c != '\t') {
+            break;
         }
-        qstr_end++;
-        qstr_start = qstr_end;
+        escaped = true;
+        qstr_end += 2;
     }
+    *current_char = qstr_end;
     if (*qstr_end != '"') {
         // strict parsing, ignore malformed string
-        if (!uw_string_truncate(&result, 0)) {
-            return UwOOM();
-        }
-    } else {
-        qstr_length = qstr_end - qstr_start;
-        if (qstr_length) {
-            if (!uw_string_append_substring_cstr(&result, qstr_start, 0, qstr_length)) {
-                return UwOOM();
-            }
+        *result = (HttpSlice) { .ptr = qstr_start, .length = 0 };
+        return true;
+    }
+    (*current_char)++;  // skip closing quote
+
+    size_t length = qstr_end - qstr_start;
+    if (!escaped) {
+        *result = (HttpSlice) { .ptr = qstr_start, .length = length };
+        return true;
+    }
+    char* unescaped = http_arena_alloc(arena, length);
+    if (!unescaped) {
+        return false;
+    }
+    size_t n = 0;
+    for (char* p = qstr_start; p < qstr_end; p++) {
+        if (*p == '\\') {
+            p++;
         }
-        qstr_end++;  // skip closing quote
+        unescaped[n++] = *p;
     }
-    *current_char = qstr_end;
-    return uw_move(&result);
+    *result = (HttpSlice) { .ptr = unescaped, .length = n };
+    return true;
 }
 
 static inline bool is_mime_charsetc(char c)
@@ -199,79 +117,42 @@ static inline bool is_mime_charsetc(char c)
  *                 ; SHOULD be registered in the IANA charset registry
  */
 {
-    if (isalnum(c)) {
-        return true;
-    }
-    switch (c) {
-        case '!':  case '#':  case '$':  case '%':  case '&':
-        case '+':  case '-':  case '^':  case '_':  case '`':
-        case '{':  case '}':  case '~':
-            return true;
-        default:
-            return false;
-    }
+    return http_char_class[(unsigned char) c] & HTTP_CHAR_MIME_CHARSETC;
 }
 
-static inline char xdigit_to_num(char** current_char)
+static inline int xdigit_to_num(char c)
+/*
+ * Return -1 if c is not a hex digit.
+ */
 {
-    char c = **current_char;
-
-    if (!isxdigit(c)) {
-        return 0;
-    }
-    (*current_char)++;
-    if (isdigit(c)) {
+    if ('0' <= c && c <= '9') {
         return c - '0';
-    } else if (islower(c)) {
+    } else if ('a' <= c && c <= 'f') {
         return 10 + c - 'a';
-    } else {
+    } else if ('A' <= c && c <= 'F') {
         return 10 + c - 'A';
+    } else {
+        return -1;
     }
 }
 
-static inline unsigned char parse_value_char(char** current_char)
+static inline bool is_attr_char(unsigned char c)
 /*
- * value-chars = *( pct-encoded / attr-char )
- *
- * pct-encoded = "%" HEXDIG HEXDIG
- *               ; see [RFC3986], Section 2.1
- *
  * attr-char   = ALPHA / DIGIT
  *               / "!" / "#" / "$" / "&" / "+" / "-" / "."
  *               / "^" / "_" / "`" / "|" / "~"
  *               ; token except ( "*" / "'" / "%" )
  */
 {
-    unsigned char c = **current_char;
+    return http_char_class[c] & HTTP_CHAR_ATTR_CHAR;
+}
 
-    if (isalnum(c)) {
-        (*current_char)++;
-        return c;
-    }
-    switch (c) {
-        case '!':  case '#':  case '$':  case '&':  case '+':  case '-':  case '.':
-        case '^':  case '_':  case '`':  case '|':  case '~':
-            (*current_char)++;
-            return c;
-        case '%':
-            break;
-        default:
-            return 0;
-    }
-    // pct-encoded
-    (*current_char)++;
-    char high_nibble = xdigit_to_num(current_char);
-    if (high_nibble == 0) {
-        return 0;
-    }
-    c = xdigit_to_num(current_char);
-    if (c == 0) {
-        return 0;
-    }
-    return (high_nibble << 4) | c;
+static inline bool is_pct_encoded(char* ptr)
+{
+    return ptr[0] == '%' && xdigit_to_num(ptr[1]) >= 0 && xdigit_to_num(ptr[2]) >= 0;
 }
 
-static UwResult parse_ext_value(char** current_char)
+static bool parse_ext_value(char** current_char, HttpArena* arena, HttpHeaderParam* param)
 /*
  * current_char must point to the first non-space character
  *
@@ -283,159 +164,197 @@ static UwResult parse_ext_value(char** current_char)
  *
  * language            = <Language-Tag, defined in [RFC5646], Section 2.1>
  *
- * Return string, null value if not a quoted string, or OOM error.
+ * value-chars         = *( pct-encoded / attr-char )
+ *
+ * pct-encoded         = "%" HEXDIG HEXDIG
+ *                       ; see [RFC3986], Section 2.1
+ *
+ * Set charset, language, and value of param.
+ * The value is copied to the arena only if it contains pct-encoded characters.
+ * Leave value null if ext-value is malformed.
+ *
+ * Return false if out of memory.
  */
 {
     char* charset_ptr = *current_char;
-    char* language_ptr = *current_char;
+    char* language_ptr = charset_ptr;
 
-    for (;;) {
-        if (!is_mime_charsetc(*charset_ptr)) {
-            break;
-        }
-        charset_ptr++;
+    while (is_mime_charsetc(*language_ptr)) {
+        language_ptr++;
     }
-
     *current_char = language_ptr;
     if (*language_ptr != '\'') {
         // malformed ext-value
-        return UwNull();
-    };
-
-    *language_ptr++ = 0;  // terminate charset part
-
-    char* value_ptr = language_ptr;
+        return true;
+    }
+    param->charset = (HttpSlice) { .ptr = charset_ptr, .length = language_ptr - charset_ptr };
+    language_ptr++;
 
     // get language tag by simply searching closing single quote
-    for (;;) {
-        char c = *value_ptr;
-        if (c == '\'' || c == 0) {
-            break;
-        }
+    char* value_ptr = language_ptr;
+    while (*value_ptr != '\'' && *value_ptr != 0) {
         value_ptr++;
     }
     *current_char = value_ptr;
-
     if (*value_ptr != '\'') {
         // malformed ext-value
-        return UwNull();
-    }
-    *value_ptr++ = 0;  // terminate language part
-    *current_char = value_ptr;
-
-    UwValue value = uw_create_empty_string(strlen(value_ptr) + 1, 1);
-    if (uw_error(&value)) {
-        return uw_move(&value);
+        return true;
     }
+    param->language = (HttpSlice) { .ptr = language_ptr, .length = value_ptr - language_ptr };
+    value_ptr++;
 
+    char* value_end = value_ptr;
+    bool encoded = false;
     for (;;) {
-        unsigned char c = parse_value_char(current_char);
-        if (c == 0) {
+        if (is_attr_char(*value_end)) {
+            value_end++;
+        } else if (is_pct_encoded(value_end)) {
+            encoded = true;
+            value_end += 3;
+        } else {
             break;
         }
-        if (!uw_string_append_char(&value, c)) {
-            return UwOOM();
-        }
     }
+    *current_char = value_end;
 
-    UwValue charset = uw_create_string_cstr(charset_ptr);
-    if (uw_error(&charset)) {
-        return uw_move(&charset);
+    size_t length = value_end - value_ptr;
+    if (!encoded) {
+        param->value = (HttpSlice) { .ptr = value_ptr, .length = length };
+        return true;
     }
-
-    UwValue language = uw_create_string_cstr(language_ptr);
-    if (uw_error(&language)) {
-        return uw_move(&language);
+    char* decoded = http_arena_alloc(arena, length);
+    if (!decoded) {
+        return false;
     }
+    size_t n = 0;
+    for (char* p = value_ptr; p < value_end; p++) {
+        if (*p == '%') {
+            decoded[n++] = (char) ((xdigit_to_num(p[1]) << 4) | xdigit_to_num(p[2]));
+            p += 2;
+        } else {
+            decoded[n++] = *p;
+        }
+    }
+    param->value = (HttpSlice) { .ptr = decoded, .length = n };
+    return true;
+}
 
-    return UwMap(
-        UwCharPtr("charset"),  uw_move(&charset),
-        UwCharPtr("language"), uw_move(&language),
-        UwCharPtr("value"),    uw_move(&value)
-    );
+static HttpHeaderParam* add_param(HttpHeaderView* view, HttpArena* arena, unsigned* capacity)
+{
+    if (view->num_params == *capacity) {
+        unsigned new_capacity = *capacity? *capacity * 2 : 4;
+        HttpHeaderParam* new_params = http_arena_alloc(arena, new_capacity * sizeof(HttpHeaderParam));
+        if (!new_params) {
+            return nullptr;
+        }
+        if (view->num_params) {
+            memcpy(new_params, view->params, view->num_params * sizeof(HttpHeaderParam));
+        }
+        view->params = new_params;
+        *capacity = new_capacity;
+    }
+    HttpHeaderParam* param = &view->params[view->num_params++];
+    *param = (HttpHeaderParam) {};
+    return param;
 }
 
-static bool parse_media_type(char** current_char, HttpRequestData* req)
+static bool parse_params(char** current_char, HttpArena* arena, HttpHeaderView* view, bool allow_ext_value)
 /*
- * https://datatracker.ietf.org/doc/html/rfc7231#section-3.1.1.1
- *
- * media-type = type "/" subtype *( OWS ";" OWS parameter )
- * type       = token
- * subtype    = token
+ * *( OWS ";" OWS parameter )
  *
  * parameter  = token "=" ( token / quoted-string )
+ *            | ext-token "=" ext-value
+ *
+ * ext-token  = <the characters in token, followed by "*">
  *
  * XXX: replaced OWS with LWSP
+ *
+ * Return false if out of memory.
  */
 {
-    UwValue media_type = parse_token(current_char);
-    if (uw_error(&media_type)) {
-        return false;
-    }
-    if (**current_char == 0) {
-        return false;
-    }
-    if (**current_char != '/') {
-        return false;
-    }
-    (*current_char)++;
-
-    UwValue media_subtype = parse_token(current_char);
-    if (uw_error(&media_subtype)) {
-        return false;
-    }
-
-    UwValue params = UwMap();
+    unsigned capacity = 0;
     for (;;) {
         skip_lwsp(current_char);
-        if (**current_char == 0) {
-            break;
-        }
         if (**current_char != ';') {
-            // malformed header, but we've got as most as we could, haven't we?
+            // end of header or malformed one, but we've got as most as we could, haven't we?
             break;
         }
         (*current_char)++;
         skip_lwsp(current_char);
-        {
-            UwValue param_name = parse_token(current_char);
-            skip_lwsp(current_char);
-            if (**current_char != '=') {
-                break;
-            }
-            (*current_char)++;
-            skip_lwsp(current_char);
 
-            if (**current_char == 0) {
-                break;
-            }
+        HttpSlice param_name = parse_token(current_char);
+        bool is_ext_value = false;
+        if (allow_ext_value && param_name.length > 1 && param_name.ptr[param_name.length - 1] == '*') {
+            // asterisk is not a separator and ends up in the token
+            is_ext_value = true;
+            param_name.length--;
+        }
+        skip_lwsp(current_char);
+        if (**current_char != '=') {
+            break;
+        }
+        (*current_char)++;
+        skip_lwsp(current_char);
 
-            UwValue param_value = UwNull();
-            if (**current_char == '"') {
-                param_value = parse_quoted_string(current_char);
-            } else {
-                param_value = parse_token(current_char);
-            }
-            if (!uw_is_string(&param_value)) {
-                break;
-            }
+        if (**current_char == 0) {
+            break;
+        }
 
-            uw_string_lower(&param_name);
-            if (!uw_map_update(&params, &param_name, &param_value)) {
-                return false;
-            }
+        HttpHeaderParam* param = add_param(view, arena, &capacity);
+        if (!param) {
+            return false;
+        }
+        param->name = param_name;
+        param->is_ext_value = is_ext_value;
+
+        bool ok;
+        if (is_ext_value) {
+            ok = parse_ext_value(current_char, arena, param);
+        } else if (**current_char == '"') {
+            ok = parse_quoted_string(current_char, arena, &param->value);
+        } else {
+            param->value = parse_token(current_char);
+            ok = true;
+        }
+        if (!ok) {
+            return false;
+        }
+        if (!param->value.ptr) {
+            // malformed value
+            view->num_params--;
+            break;
         }
     }
-    uw_destroy(&req->media_type);
-    uw_destroy(&req->media_subtype);
-    uw_destroy(&req->media_type_params);
-    req->media_type        = uw_move(&media_type);
-    req->media_subtype     = uw_move(&media_subtype);
-    req->media_type_params = uw_move(&params);
     return true;
 }
 
-static bool parse_content_disposition(char** current_char, HttpRequestData* req)
+bool http_parse_media_type(char* header, HttpArena* arena, HttpHeaderView* view)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc7231#section-3.1.1.1
+ *
+ * media-type = type "/" subtype *( OWS ";" OWS parameter )
+ * type       = token
+ * subtype    = token
+ */
+{
+    *view = (HttpHeaderView) {};
+
+    char* current_char = header;
+    view->type = parse_token(&current_char);
+    if (*current_char != '/') {
+        return false;
+    }
+    current_char++;
+    view->subtype = parse_token(&current_char);
+
+    if (!parse_params(&current_char, arena, view, false)) {
+        return false;
+    }
+    view->valid = true;
+    return true;
+}
+
+bool http_parse_content_disposition(char* header, HttpArena* arena, HttpHeaderView* view)
 /*
  * content-disposition = "Content-Disposition" ":"
  *                             disposition-type *( ";" disposition-parm )
@@ -452,65 +371,178 @@ static bool parse_content_disposition(char** current_char, HttpRequestData* req)
  *
  * disp-ext-parm       = token "=" value
  *                     | ext-token "=" ext-value
- *
- * ext-token           = <the characters in token, followed by "*">
  */
 {
-    UwValue disposition_type = parse_token(current_char);
-    if (uw_error(&disposition_type)) {
+    *view = (HttpHeaderView) {};
+
+    char* current_char = header;
+    view->type = parse_token(&current_char);
+
+    if (!parse_params(&current_char, arena, view, true)) {
         return false;
     }
-    uw_string_lower(&disposition_type);
+    view->valid = true;
+    return true;
+}
 
-    UwValue params = UwMap();
-    for (;;) {
-        skip_lwsp(current_char);
-        if (**current_char == 0) {
-            break;
-        }
-        if (**current_char != ';') {
-            // malformed header, but we've got as most as we could, haven't we?
-            break;
+bool http_slice_equal(HttpSlice* slice, char* str)
+{
+    size_t i = 0;
+    for (; i < slice->length; i++) {
+        if (str[i] == 0 || tolower((unsigned char) slice->ptr[i]) != tolower((unsigned char) str[i])) {
+            return false;
         }
-        (*current_char)++;
-        skip_lwsp(current_char);
-        {
-            bool is_ext_value = false;
+    }
+    return str[i] == 0;
+}
 
-            UwValue param_name = parse_token(current_char);
-            if (**current_char == '*') {
-                is_ext_value = true;
-                (*current_char)++;
-            }
-            skip_lwsp(current_char);
-            if (**current_char != '=') {
-                break;
+HttpHeaderParam* http_header_view_param(HttpHeaderView* view, char* name)
+{
+    HttpHeaderParam* result = nullptr;
+    for (unsigned i = 0; i < view->num_params; i++) {
+        HttpHeaderParam* param = &view->params[i];
+        if (http_slice_equal(&param->name, name)) {
+            // ext-value takes precedence, see RFC 6266 section 4.3
+            if (!result || param->is_ext_value || !result->is_ext_value) {
+                result = param;
             }
-            (*current_char)++;
-            skip_lwsp(current_char);
+        }
+    }
+    return result;
+}
 
-            if (**current_char == 0) {
-                break;
-            }
+/****************************************************************
+ * Conversion of parsed headers to UW values
+ */
 
-            UwValue param_value = UwNull();
-            if (is_ext_value) {
-                param_value = parse_ext_value(current_char);
-            } else if (**current_char == '"') {
-                param_value = parse_quoted_string(current_char);
-            } else {
-                param_value = parse_token(current_char);
-            }
-            if (!uw_is_string(&param_value)) {
-                break;
-            }
+static UwResult slice_to_string(HttpSlice* slice)
+{
+    UwValue result = UwString();
+    if (slice->length) {
+        if (!uw_string_append_substring_cstr(&result, slice->ptr, 0, slice->length)) {
+            return UwOOM();
+        }
+    }
+    return uw_move(&result);
+}
 
-            uw_string_lower(&param_name);
-            if (!uw_map_update(&params, &param_name, &param_value)) {
-                return false;
+static UwResult ext_value_to_map(HttpHeaderParam* param)
+{
+    UwValue charset = slice_to_string(&param->charset);
+    if (uw_error(&charset)) {
+        return uw_move(&charset);
+    }
+    UwValue language = slice_to_string(&param->language);
+    if (uw_error(&language)) {
+        return uw_move(&language);
+    }
+    UwValue value = UwNull();
+    if (http_slice_equal(&param->charset, "UTF-8")) {
+        value = slice_to_string(&param->value);
+        if (uw_error(&value)) {
+            return uw_move(&value);
+        }
+    } else {
+        // octets are ISO-8859-1 code points
+        value = uw_create_empty_string(param->value.length, 1);
+        if (uw_error(&value)) {
+            return uw_move(&value);
+        }
+        for (unsigned i = 0; i < param->value.length; i++) {
+            if (!uw_string_append_char(&value, (unsigned char) param->value.ptr[i])) {
+                return UwOOM();
             }
         }
     }
+    return UwMap(
+        UwCharPtr("charset"),  uw_move(&charset),
+        UwCharPtr("language"), uw_move(&language),
+        UwCharPtr("value"),    uw_move(&value)
+    );
+}
+
+static bool has_ext_value(HttpHeaderView* view, HttpSlice* name)
+{
+    for (unsigned i = 0; i < view->num_params; i++) {
+        HttpHeaderParam* param = &view->params[i];
+        if (param->is_ext_value && param->name.length == name->length
+            && strncasecmp(param->name.ptr, name->ptr, name->length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static UwResult params_to_map(HttpHeaderView* view)
+/*
+ * Values of ext-value parameters are maps containing charset, language, and value.
+ */
+{
+    UwValue params = UwMap();
+    if (uw_error(&params)) {
+        return uw_move(&params);
+    }
+    for (unsigned i = 0; i < view->num_params; i++) {
+        HttpHeaderParam* param = &view->params[i];
+        if (!param->is_ext_value && has_ext_value(view, &param->name)) {
+            // ext-value takes precedence
+            continue;
+        }
+        UwValue param_name = slice_to_string(&param->name);
+        if (uw_error(&param_name)) {
+            return uw_move(&param_name);
+        }
+        UwValue param_value = param->is_ext_value? ext_value_to_map(param) : slice_to_string(&param->value);
+        if (uw_error(&param_value)) {
+            return uw_move(&param_value);
+        }
+        uw_string_lower(&param_name);
+        if (!uw_map_update(&params, &param_name, &param_value)) {
+            return UwOOM();
+        }
+    }
+    return uw_move(&params);
+}
+
+static bool set_media_type_values(HttpRequestData* req)
+{
+    HttpHeaderView* view = &req->content_type_view;
+
+    UwValue media_type = slice_to_string(&view->type);
+    if (uw_error(&media_type)) {
+        return false;
+    }
+    UwValue media_subtype = slice_to_string(&view->subtype);
+    if (uw_error(&media_subtype)) {
+        return false;
+    }
+    UwValue params = params_to_map(view);
+    if (uw_error(&params)) {
+        return false;
+    }
+    uw_destroy(&req->media_type);
+    uw_destroy(&req->media_subtype);
+    uw_destroy(&req->media_type_params);
+    req->media_type        = uw_move(&media_type);
+    req->media_subtype     = uw_move(&media_subtype);
+    req->media_type_params = uw_move(&params);
+    return true;
+}
+
+static bool set_disposition_values(HttpRequestData* req)
+{
+    HttpHeaderView* view = &req->disposition_view;
+
+    UwValue disposition_type = slice_to_string(&view->type);
+    if (uw_error(&disposition_type)) {
+        return false;
+    }
+    uw_string_lower(&disposition_type);
+
+    UwValue params = params_to_map(view);
+    if (uw_error(&params)) {
+        return false;
+    }
     uw_destroy(&req->disposition_type);
     uw_destroy(&req->disposition_params);
     req->disposition_type   = uw_move(&disposition_type);
@@ -518,40 +550,79 @@ static bool parse_content_disposition(char** current_char, HttpRequestData* req)
     return true;
 }
 
+static void reset_media_type_values(HttpRequestData* req)
+{
+    uw_destroy(&req->media_type);
+    uw_destroy(&req->media_subtype);
+    uw_destroy(&req->media_type_params);
+    req->media_type        = UwString();
+    req->media_subtype     = UwString();
+    req->media_type_params = UwMap();
+}
+
+HttpHeaderView* http_request_content_type_view(HttpRequestData* req)
+{
+    if (!(req->parsed_headers & HTTP_PARSED_CONTENT_TYPE_VIEW)) {
+        req->parsed_headers |= HTTP_PARSED_CONTENT_TYPE_VIEW;
+
+        char* content_type = http_response_header(req, "Content-Type");
+        if (content_type) {
+            if (!http_parse_media_type(content_type, &req->response_headers.arena, &req->content_type_view)) {
+                fprintf(stderr, "WARNING: failed to parse content type %s\n", content_type);
+            }
+        }
+    }
+    return &req->content_type_view;
+}
+
+HttpHeaderView* http_request_disposition_view(HttpRequestData* req)
+{
+    if (!(req->parsed_headers & HTTP_PARSED_DISPOSITION_VIEW)) {
+        req->parsed_headers |= HTTP_PARSED_DISPOSITION_VIEW;
+
+        char* content_disposition = http_response_header_latest(req, "Content-Disposition");
+        if (content_disposition) {
+            if (!http_parse_content_disposition(content_disposition, &req->response_headers.arena, &req->disposition_view)) {
+                fprintf(stderr, "WARNING: failed to parse content dispostion %s\n", content_disposition);
+            }
+        }
+    }
+    return &req->disposition_view;
+}
+
 void http_request_parse_content_type(HttpRequestData* req)
-/*
- * Parse content-type header
- */
 {
-    CURLcode res;
-    char* content_type;
-    res = curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_TYPE, &content_type);
-    if (res != CURLE_OK) {
+    if (req->parsed_headers & HTTP_PARSED_CONTENT_TYPE) {
         return;
     }
-    if (!content_type) {
+    req->parsed_headers |= HTTP_PARSED_CONTENT_TYPE;
+
+    if (!http_request_content_type_view(req)->valid) {
+        reset_media_type_values(req);
         return;
     }
-    char* ct = content_type;
-    if (!parse_media_type(&ct, req)) {
-        fprintf(stderr, "WARNING: failed to parse content type %s\n", content_type);
+    if (!set_media_type_values(req)) {
+        fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+        reset_media_type_values(req);
     }
 }
 
 void http_request_parse_content_disposition(HttpRequestData* req)
-/*
- * Parse content-disposition header
- */
 {
-    char* content_disposition = get_response_header(req->easy_handle, "Content-Disposition");
-    if (!content_disposition) {
+    if (req->parsed_headers & HTTP_PARSED_DISPOSITION) {
         return;
     }
+    req->parsed_headers |= HTTP_PARSED_DISPOSITION;
 
-    puts(content_disposition);
-    char* p = content_disposition;
-    if (!parse_content_disposition(&p, req)) {
-        fprintf(stderr, "WARNING: failed to parse content dispostion %s\n", content_disposition);
+    if (!http_request_disposition_view(req)->valid) {
+        uw_destroy(&req->disposition_type);
+        uw_destroy(&req->disposition_params);
+        return;
+    }
+    if (!set_disposition_values(req)) {
+        fprintf(stderr, "ERROR %s: out of memory\n", __func__);
+        uw_destroy(&req->disposition_type);
+        uw_destroy(&req->disposition_params);
     }
 }
 
@@ -561,6 +632,36 @@ void http_request_parse_headers(HttpRequestData* req)
     http_request_parse_content_disposition(req);
 }
 
+UwValuePtr http_request_media_type(HttpRequestData* req)
+{
+    http_request_parse_content_type(req);
+    return &req->media_type;
+}
+
+UwValuePtr http_request_media_subtype(HttpRequestData* req)
+{
+    http_request_parse_content_type(req);
+    return &req->media_subtype;
+}
+
+UwValuePtr http_request_media_type_params(HttpRequestData* req)
+{
+    http_request_parse_content_type(req);
+    return &req->media_type_params;
+}
+
+UwValuePtr http_request_disposition_type(HttpRequestData* req)
+{
+    http_request_parse_content_disposition(req);
+    return &req->disposition_type;
+}
+
+UwValuePtr http_request_disposition_params(HttpRequestData* req)
+{
+    http_request_parse_content_disposition(req);
+    return &req->disposition_params;
+}
+
 UwResult http_request_get_filename(HttpRequestData* req)
 /*
  * Get file name from the following sources:
@@ -573,9 +674,10 @@ UwResult http_request_get_filename(HttpRequestData* req)
  * If no filename found and URL ends with slash, return "index.html"
  */
 {
-    if (uw_is_map(&req->disposition_params)) {
+    UwValuePtr disposition_params = http_request_disposition_params(req);
+    if (uw_is_map(disposition_params)) {
         if (uw_is_string(&req->disposition_type) && uw_equal(&req->disposition_type, "attachment")) {
-            UwValue filename = uw_map_get(&req->disposition_params, "filename");
+            UwValue filename = uw_map_get(disposition_params, "filename");
             if (uw_ok(&filename)) {
                 if (uw_is_map(&filename)) {
                     UwValue fname = uw_map_get(&filename, "value");
@@ -596,7 +698,7 @@ UwResult http_request_get_filename(HttpRequestData* req)
 
     UwValue parts = UwNull();
 
-    char* last_location = get_response_header(req->easy_handle, "Location");
+    char* last_location = http_response_header_latest(req, "Location");
     if (last_location) {
         UwValue location = uw_create_string_cstr(last_location);
         if (uw_error(&location)) {